@@ -0,0 +1,64 @@
+/*
+	Object:		MATLAB binding of the labeling library (see connected_component_labeling.h),
+				in place of running soil-sealing on text files (see data/test_labeling.m).
+	Authors:	Massimo Nicolazzo & Giuliano Langella
+	email:		gyuliano@libero.it
+
+	Build:
+		mex -DCCL_LIBRARY CFLAGS='$CFLAGS -pthread' ccl_mex.c connected_component_labeling.c
+
+	Usage:
+		[L, n] = ccl_mex( A [, conn [, tiledim [, nThreads]]] )
+
+		A			mask, logical or uint8 (1 object, any other value background)
+		conn		8 (default) or 4
+		tiledim		[tiledimX tiledimY] of the tiles, or 0 for auto (default)
+		nThreads	workers labelling tiles concurrently (default 1)
+		L			labels of A (uint32, 0 background): the objects of bwlabel, numbered
+					tile by tile
+		n			number of objects
+
+	MATLAB stores A by columns: the library labels its columns as rows, which gives the
+	same objects.
+*/
+#include "mex.h"
+#include "connected_component_labeling.h"
+
+void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[] )
+{
+	ccl_options		opt = CCL_DEFAULT_OPTIONS;
+	ccl_context		*ctx;
+	unsigned int	nobjects, rows, cols;
+	double			*td;
+
+	if( nrhs<1 || nrhs>4 || nlhs>2 ) mexErrMsgTxt("Usage: [L, n] = ccl_mex( A [, conn [, tiledim [, nThreads]]] )");
+	if( (!mxIsLogical(prhs[0]) && !mxIsUint8(prhs[0])) || mxGetNumberOfDimensions(prhs[0])!=2 )
+		mexErrMsgTxt("A must be a logical or uint8 matrix!");
+	if( nrhs>1 ) opt.connectivity = (unsigned int)mxGetScalar(prhs[1]);
+	if( nrhs>2 )
+	{
+		if( !mxIsDouble(prhs[2]) || mxGetNumberOfElements(prhs[2])<1 ) mexErrMsgTxt("tiledim must be double!");
+		td				= mxGetPr(prhs[2]);
+		opt.tiledimX	= (unsigned int)td[0];
+		opt.tiledimY	= (unsigned int)td[ mxGetNumberOfElements(prhs[2])>1 ];
+	}
+	if( nrhs>3 ) opt.threads = (unsigned int)mxGetScalar(prhs[3]);
+
+	// the columns of A are the rows of the library
+	rows	= (unsigned int)mxGetN(prhs[0]);
+	cols	= (unsigned int)mxGetM(prhs[0]);
+	plhs[0]	= mxCreateNumericMatrix( cols, rows, mxUINT32_CLASS, mxREAL );
+	if( rows==0 || cols==0 ) { nobjects = 0; }
+	else
+	{
+		ctx = ccl_create(&opt);
+		if( ctx==NULL ) mexErrMsgTxt("conn must be 8 or 4, and tiledim 0 or at least 2!");
+		if( ccl_label( ctx, (const uint8_t*)mxGetData(prhs[0]), rows, cols, cols, (uint32_t*)mxGetData(plhs[0]), cols, &nobjects ) )
+		{
+			ccl_destroy(ctx);
+			mexErrMsgTxt("Error labelling A: out of memory or threads!");
+		}
+		ccl_destroy(ctx);
+	}
+	if( nlhs>1 ) plhs[1] = mxCreateDoubleScalar(nobjects);
+}
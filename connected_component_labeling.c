@@ -20,6 +20,150 @@ DESCRIPTION:
 		> nw, nn, ne, ww are the north-west, north, north-east and west pixels in the eight connected connectivity,
 		> xx are skipped pixels.
 	Therefore the mask has 4 active pixels with(out) object pixels (that is foreground pixels).
+	With 4-connectivity (-n 4) the mask is { nn, ww } only, and with classes (-M) a pixel of the
+	mask joins cc only if it has the same class.
+
+-----------
+USAGE:
+-----------
+
+	soil-sealing [-i in_file] [-o out_file] [-f format] [-t nThreads] [-H] [-S spill_file] [-e engine] [-s stats_file]
+		[-m metrics_file] [-w window_file -k size[:step]] [-u update_file [-c changes_file]] [-C cache_dir]
+		[-n 4|8] [-M] [-P] [-a min_area] [-l largest] [-F hole_area] [-d dist_file]
+		[-N near_file] [-B bench_file] [-J trace_file] [-Z shard_dir -x shard:gx:gy:run] tiledimX tiledimY [NC NR]
+	soil-sealing -Z shard_dir -x merge:run [-o out_file] [-J trace_file]
+	soil-sealing -V rounds
+
+		-i	input mask (default /home/giuliano/git/soil-sealing/data/ALL.txt, as written by
+			data/test_labeling.m), either text (one value per pixel, NC x NR
+			values) or binary: a header {"CCLB", rows, cols, bits} of four 32-bit fields
+			followed by the rows of pixels, 8 bits (one byte per pixel), 16 bits (classes
+			only, see -M) or 1 bit (packed, pixel c is bit c%8 of byte c/8 of the row).
+			Binary masks are mapped in memory and NC, NR can be omitted since they are read
+			from the header.
+			TIFF/BigTIFF masks (single band, 8 bits, tiles or strips, uncompressed, PackBits
+			or Deflate) are mapped in memory too, and strips/tiles are decoded only when the
+			labeling tiles over them are processed.
+		-o	output labels (default /home/giuliano/git/soil-sealing/data/Ccode.txt, as read by
+			data/test_labeling.m)
+		-f	format of the output labels (see open_labels):
+				text	one value per pixel (default)
+				bin		header {"CCLL", rows, cols, bits, objects, chunks, rows per chunk, 0}
+						of 32-bit fields followed by the rows of labels, 16 bits if the
+						objects fit and 32 bits otherwise
+				zbin	as bin, but every row of tiles is a zlib chunk located by a table
+						of {offset,size} 64-bit pairs after the header
+				tiff	TIFF with one strip per row of tiles, keeping the georeferencing
+						tags of a TIFF input
+				ztiff	as tiff, Deflate compressed
+		-t	number of threads labeling tiles concurrently (default 1)
+		-H	merge the tile seams hierarchically (2x2, 4x4, ... blocks of tiles in parallel)
+		-S	streaming mode: the image is labelled by bands of one row of tiles and the
+			provisional labels are spilled to spill_file (for images larger than RAM)
+		-e	engine of the first scan: pixels (default, the forward scan mask) or runs
+			(foreground runs of every row, extracted by SSE2/AVX2, are labelled against the
+			runs of the previous row); both give the same labels
+		-s	statistics of every object, accumulated during the first scan: area, perimeter
+			(sides of its pixels facing background), bounding box and centroid, in image
+			coordinates (row, column from 0). CSV if stats_file ends with .csv, otherwise
+			a header {"CCLS", objects, record size, 0} of 32-bit fields followed by one
+			record {area, perimeter, sum of rows, sum of columns} (64 bits) {min row,
+			min column, max row, max column} (32 bits) per object
+		-m	landscape metrics of the image (CSV, see write_metrics): patch density, largest
+			patch index, mean patch size, edge density and fragmentation (effective mesh
+			size, division, splitting index), swept on the tiles with the final scan
+		-w	landscape metrics of moving windows size pixels wide, one every step pixels
+			(default step = size), on the objects of the whole image clipped to the window:
+			CSV if window_file ends with .csv, otherwise a header {"CCLW", rows, cols,
+			metrics, size, step, 0, 0} of 32-bit fields followed by the grid of windows,
+			5 floats per window {% sealed, patches, largest patch index, edge density,
+			effective mesh size}
+		-u	two epochs: update_file is the mask of the second epoch (same size and formats
+			of in_file), and the outputs (-o, -s, -m, -w) are of the second epoch. Only the
+			tiles whose pixels changed are labelled again, the others keep the labels of
+			the first epoch (see update_labeling)
+		-c	correspondence of the objects of the two epochs (CSV, see write_changes): the
+			pixels shared by every pair of objects and the event (new, vanished, grown,
+			shrunk, unchanged, merged, split)
+		-C	tile cache: the first stage of every tile is kept in cache_dir, one file per
+			distinct tile content named by its hash, and tiles found there are read back
+			instead of labelled (see cache_load). It serves reruns on rasters that are
+			mostly the same, in any mode
+		-n	connectivity of the objects: 8 (default) or 4
+		-M	multi-class labeling: in_file holds classes (uint8 from an 8-bit binary mask or
+			TIFF, uint16 from a 16-bit binary mask or text) and the objects are made of
+			pixels of the same class, any but the background 0. The perimeter (-s) counts
+			the sides facing another class and the class of every object is added to the
+			statistics (last CSV column, or nobjects 16-bit values after the records).
+			Only in memory, by pixels and without -u, -C, -m, -w
+		-P	tiles partition the image: every tile scans the tiledimX-1 x tiledimY-1 pixels
+			it owns, once, and its first row/column (the last ones of the nn/ww tiles) are
+			only read, for the perimeter (-s). The seams are stitched across the pixels of
+			the two tiles facing each other (and the diagonal tiles with 8-connectivity),
+			instead of the pixels both tiles labelled. Not with -M
+		-a	objects smaller than min_area pixels (the minimum mapping unit) are dropped
+		-l	only the largest objects are kept (the smaller IDs at equal area). The objects
+			of -a and -l are dropped by their final ID (0, and the others numbered again,
+			see filter_objects), so that the final scan writes the filtered labels; the
+			outputs (-o, -s, -m, -w) are of the filtered objects
+		-F	holes (components of the background, with the complementary connectivity, not
+			touching the border of the image) smaller than hole_area pixels are filled
+			before the objects are labelled, see fill_holes. -a, -l and -F work in memory,
+			without -M and -u
+		-d	distance transform: the exact Euclidean distance of every pixel to the nearest
+			object pixel (0 on the objects), by separable passes on the columns and the
+			rows of the tiles (see distance_transform). dist_file is a header {"CCLD",
+			rows, cols, 32, 0, 0, 0, 0} of 32-bit fields followed by the rows of
+			distances, one float per pixel (+inf if there is no object)
+		-N	the label of the nearest object of every pixel (of the pixel itself on the
+			objects), in the format of the labels (-f). -d and -N work in memory, on the
+			objects written to -o
+		-B	benchmark (no input, no outputs): synthetic masks generated with fixed seeds
+			(uniform random at densities 0.2, 0.5, 0.8 and at the percolation threshold,
+			a spiral, a snake and clustered urban-like noise, see bench_mask) of NC x NR
+			pixels (default 4096 x 4096), halved and quartered, are labelled with 1, 2,
+			4, ... nThreads threads and the time of every stage (first scan, relabel,
+			second scan, intra-tile, cross-tile, third scan, total) goes to bench_file,
+			CSV with the Mpixel/s (see benchmark). -n, -e, -H and the tiles apply
+		-J	instrumentation: JSON lines in trace_file, one per stage with its wall seconds
+			(read, holes, intra_tile, cross_tile, update, filter, stats, final_scan, windows,
+			distance, write; bands in streaming, shard and merge in sharding), one on the seams (keys
+			of final_parent, objects, keys merged, levels of -H), one per tile (seconds of
+			first scan, relabel and second scan, provisional labels and fill of nID, compact
+			labels, merged ones, cached) and a summary with the peak resident memory (see
+			trace_stage)
+		-Z	sharded labeling by processes (e.g. on the nodes of a cluster), meeting in
+		-x	shard_dir: the tiles are split in a grid of gx x gy blocks, and the process of
+			-x shard:gx:gy:run labels the block shard (0..gx*gy-1, in raster order) reading
+			its rows of the mask only. Its seam file (the objects of the block and the
+			labels along its border, see shard_labeling) goes to shard_dir, where the
+			process of -x merge:run joins the objects of all the shards (see shard_merge),
+			creates out_file (always -f bin, at its full size) and gives every shard the
+			global IDs of its objects and the absolute path of out_file, which must reach
+			the same file from every process (-o and -f of the shards are not used); each
+			shard then writes its own rows of labels. The merge exits before the shards
+			write: the labels are complete only when every shard has exited with 0. The
+			processes wait for the files of each other, in any order of start, and the
+			labels are the same of one process with the same tiles. run is a token of the
+			run (e.g. the job ID), the same for all its processes and new for every run:
+			files of other runs left in shard_dir are never read. A process that fails stops
+			the others, and one waits SHARD_TIMEOUT seconds at most for a file (see
+			wait_file). Binary or TIFF masks, with -t, -H, -e, -n, -P, -C
+		-V	verification, instead of the comparison with bwlabel of data/test_labeling.m:
+			rounds random masks and tilings are labelled by every engine, connectivity,
+			seam merge, tiling (-P) and 1/4 threads, and checked against a flood fill (same objects,
+			whatever their numbering). It prints the cases that fail and exits with 1 if
+			any (see verify)
+		tiledimX tiledimY
+			size of the tiles, which overlap by one row/column (see -P): every tile owns
+			tiledimX-1 columns and tiledimY-1 rows of the image, the tiles of the last column/row what
+			is left. "auto" (or 0) sizes the tiles to the L2/L3 caches, the threads and the
+			image (see auto_tile_size)
+
+	Build with -pthread (add -DWITH_ZLIB -lz for zbin, ztiff and Deflate TIFF input,
+	and -mavx2 to extract runs by AVX2 instead of SSE2).
+	Build with -DCCL_LIBRARY to leave main out and call the labeling in process (see
+	connected_component_labeling.h, and ccl_mex.c for MATLAB).
 
 */
 
@@ -29,49 +173,514 @@ DESCRIPTION:
 #include <stdint.h>
 #include <errno.h>        /* errno */
 #include <string.h>       /* strerror */
-#include <math.h>			// ceil
+#include <math.h>			// sqrt
+#include <pthread.h>		// thread pool
+#include <unistd.h>			// getopt
+#include <fcntl.h>			// open
+#include <sys/mman.h>		// mmap
+#include <sys/stat.h>		// fstat
+#include <time.h>			// clock_gettime
+#include <sys/resource.h>	// getrusage
+#ifdef WITH_ZLIB
+#include <zlib.h>			// compress2
+#endif
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>		// run extraction in first_scan_runs
+#endif
+#include "connected_component_labeling.h"	// library API (see ccl_label)
 
 // DEFINES
 //	-indexes
-#define durban(c,r)		urban[		(c)	+	(r)	*ncols		] // I: scan value at current [r,c] 
-#define nw_pol(c,r)		lab_mat[	(c-1)	+	(r-1)	*(ncols)	] // O: scan value at North-West
-#define nn_pol(c,r)		lab_mat[	(c+0)	+	(r-1)	*(ncols)	] // O: scan value at North
-#define ne_pol(c,r)		lab_mat[	(c+1)	+	(r-1)	*(ncols)	] // O: scan value at North-East
-#define ww_pol(c,r)		lab_mat[	(c-1)	+	(r+0)	*(ncols)	] // O: scan value at West
-#define cc_pol(c,r)		lab_mat[	(c+0)	+	(r+0)	*(ncols)	] // O: scan value at current [r,c] which is shifted by [1,1] in O
+#define nw_pol(c,r)		lab_mat[	(c-1)	+	(r-1)	*(stride)	] // O: scan value at North-West
+#define nn_pol(c,r)		lab_mat[	(c+0)	+	(r-1)	*(stride)	] // O: scan value at North
+#define ne_pol(c,r)		lab_mat[	(c+1)	+	(r-1)	*(stride)	] // O: scan value at North-East
+#define ww_pol(c,r)		lab_mat[	(c-1)	+	(r+0)	*(stride)	] // O: scan value at West
+#define packed_bit(P,r,c)	( packed_word((P),(r),(c)) & 1 )	// I: pixel (r,c) of a packed mask
+#define class_ptr(K,r,c)	( (unsigned char*)(K)->data + ((size_t)(r)*(K)->stride + (c))*(K)->nbytes )	// I: class of pixel (r,c)
+#define cc_pol(c,r)		lab_mat[	(c+0)	+	(r+0)	*(stride)	] // O: scan value at current [r,c] which is shifted by [1,1] in O
+#define cls_pol(c,r)	( NBYTES==1 ? ((const uint8_t*)classes)[(c)+(size_t)(r)*cstride] : ((const uint16_t*)classes)[(c)+(size_t)(r)*cstride] ) // I: class at [r,c]
+#define joins(dc,dr)	( lab_mat[(c+(dc))+(r+(dr))*(stride)]!=Vb && (!NBYTES || cls_pol(c+(dc),r+(dr))==k) ) // the neighbour at [r+dr,c+dc] is of the object of [r,c]
 //	-min/max
-#define _max(val1,val2)		(val1)>(val2)?(val1):(val2)
-#define _min(val1,val2)		(val1)<(val2)?(val1):(val2)
+#define _max(val1,val2)		( (val1)>(val2)?(val1):(val2) )
+#define _min(val1,val2)		( (val1)<(val2)?(val1):(val2) )
+//	-binary masks
+#define BIN_MAGIC			"CCLB"
+//	-output formats
+#define OUT_TEXT			0
+#define OUT_BIN				1
+#define OUT_ZBIN			2
+#define OUT_TIFF			3
+#define OUT_ZTIFF			4
+#define LAB_MAGIC			"CCLL"
+#define STATS_MAGIC			"CCLS"
+#define WIN_MAGIC			"CCLW"
+//	-landscape metrics of the moving windows (see window_row_metrics)
+#define WIN_SEALED			0		// % of object pixels
+#define WIN_PATCHES			1		// objects in the window
+#define WIN_LPI				2		// largest patch index (%)
+#define WIN_ED				3		// edge density (sides per pixel)
+#define WIN_MESH			4		// effective mesh size (pixels)
+#define WIN_METRICS			5
+#define win_center(i,step,n)	_min( (long)(i)*(step) + (step)/2, (long)(n)-1 )	// of the i-th window in a line of n pixels
+#define CACHE_MAGIC			"CCLT"
+#define CACHE_KEY			8		// uint32 fields of cache_header from nrows to partition: the key of a tile (see tile_hash)
+#define DIST_MAGIC			"CCLD"
+#define DIST_INF			UINT32_MAX	// no object pixel in the column (see distance_tile_column)
+#define SEAM_MAGIC			"CCLE"
+#define SLICE_MAGIC			"CCLP"
+#define SEAM_RECORD(tdx,tdy)	( 4*(tdx) + 4*(tdy) )	// labels of a tile on the border of a shard (see shard_labeling)
+#define SHARD_POLL			100000	// microseconds between the checks for a file of another process
+#define SHARD_TIMEOUT		3600	// seconds of wait for a file of another process (see wait_file)
+//	-first scan engines
+#define SCAN_PIXELS			0		// first_scan
+#define SCAN_RUNS			1		// first_scan_runs
+#define SCAN_ARGS			packed_mat *urban, const void *classes, size_t cstride, unsigned int *lab_mat, unsigned int stride, unsigned int *PARENT, unsigned int *work, tile_stats *ts
+#define SCAN_KERNEL(name,engine,...)	unsigned int name( SCAN_ARGS ) { return engine( urban, classes, cstride, lab_mat, stride, PARENT, work, ts, __VA_ARGS__ ); }
+//	-TIFF
+#define TIFF_NONE			1
+#define TIFF_DEFLATE		32946
+#define TIFF_ADOBE_DEFLATE	8
+#define TIFF_PACKBITS		32773
+#define TIFF_MAX_GEO		8		// georeferencing tags kept from the input
+//	-benchmark (see benchmark)
+#define BENCH_UNIFORM		0		// random pixels, object with probability density
+#define BENCH_SPIRAL		1		// one square spiral of 1-pixel path and gap
+#define BENCH_SNAKE			2		// one comb of 1-pixel columns joined alternately at the bottom and the top
+#define BENCH_URBAN			3		// clustered value noise above the quantile 1-density
+#define BENCH_SIZE			4096	// default NC, NR
+#define BENCH_REPS			3		// runs of every configuration, the fastest is reported
+#define BENCH_STAGES		7
 //#define tiledimX 12
 //#define tiledimY 12
 
 // GLOBAL VARIABLES
 unsigned char 	Vb			= 0;	// background value
 unsigned char 	Vo			= 1;	// object value
-unsigned int	cross_cols	= 4;	// number of columns of the cross_parent matrix
 unsigned char	buffer[255];
+unsigned int	nThreads	= 1;	// number of workers in the thread pool
+unsigned char	hierarchical= 0;	// 1: merge tile seams by levels of blocks, 0: tile by tile in raster order
+unsigned char	out_format	= OUT_TEXT;	// format of the output labels
+unsigned char	scan_engine	= SCAN_PIXELS;	// kernel of the first scan
+unsigned char	connectivity= 8;	// of the objects: 8 or 4
+unsigned char	multi_class	= 0;	// 1: pixels are classes, objects are made of pixels of one class
+unsigned char	partition	= 0;	// 1: tiles partition the image, their first row/column is a read-only halo (see -P)
+// (the globals above are the command line: every labeling runs on its own label_config, see cli_config)
+char			*cache_dir	= NULL;	// tile cache (see cache_load), NULL if none
+FILE			*trace_fid	= NULL;	// JSON lines of the instrumentation (see trace_stage), NULL if none
+char			shard_abort_path[4096+32] = "";	// created at the exit of a process of a sharded run (see shard_abort), "" if none
+
+// TYPES
+//	-header of binary masks (see map_mat)
+typedef struct {
+	char			magic[4];		// BIN_MAGIC
+	uint32_t		nrows;
+	uint32_t		ncols;
+	uint32_t		nbits;			// bits per pixel: 8 or 1
+} bin_header;
+//	-binary mask mapped in memory
+typedef struct {
+	void			*base;			// mapping of the whole file
+	size_t			size;
+	unsigned char	*data;			// first row of pixels
+	size_t			stride;			// bytes per row
+	unsigned int	nrows, ncols;	// size of the mask (without padding)
+	unsigned int	nbits;
+} mapped_mat;
+//	-binary mask packed at 1 bit per pixel: pixel (r,c) is bit (col0+c)%64 of word (col0+c)/64 of row r
+typedef struct {
+	uint64_t		*words;			// row 0
+	size_t			stride;			// words per row
+	unsigned int	col0;			// first column of a view (0 for a whole mask)
+	unsigned int	nrows, ncols;
+} packed_mat;
+//	-statistics of a component (image coordinates), see first_scan
+typedef struct {
+	uint64_t		area;
+	uint64_t		perimeter;		// sides of its pixels facing background (another class, see -M)
+	uint64_t		sum_r, sum_c;	// centroid = sum/area
+	uint32_t		min_r, min_c;	// bounding box
+	uint32_t		max_r, max_c;
+} comp_stats;
+//	-header of the binary statistics (see write_stats)
+typedef struct {
+	char			magic[4];		// STATS_MAGIC
+	uint32_t		nobjects;
+	uint32_t		record_size;	// sizeof(comp_stats)
+	uint32_t		has_classes;	// 1 if the class of every object (16 bits) follows the records
+} stats_header;
+//	-partial landscape metrics of a tile (see tile_metrics_sweep)
+typedef struct {
+	uint32_t		*area;			// pixels of every compact label of the tile
+	uint64_t		sealed;			// object pixels
+	uint64_t		edges;			// sides between object and background pixels
+} tile_metrics;
+//	-header of the binary moving-window metrics (see write_windows)
+typedef struct {
+	char			magic[4];		// WIN_MAGIC
+	uint32_t		nrows, ncols;	// of the grid of windows
+	uint32_t		nmetrics;		// WIN_METRICS float values per window
+	uint32_t		size, step;		// of the windows, in pixels
+	uint32_t		reserved[2];
+} win_header;
+//	-header of the binary distances (see distance_transform)
+typedef struct {
+	char			magic[4];		// DIST_MAGIC
+	uint32_t		nrows, ncols;
+	uint32_t		nbits;			// 32: one float per pixel
+	uint32_t		reserved[4];
+} dist_header;
+//	-header of the seam file of a shard (see shard_labeling), followed by the compact labels of
+//	 its tiles, the ROOT (local key) of its objects and the record of every tile on its border
+//	 (magic, shard and run first, as slice_header: see wait_file)
+typedef struct {
+	char			magic[4];		// SEAM_MAGIC
+	uint32_t		shard;			// of the gx x gy shards, in raster order
+	uint64_t		run;			// of the token of -x (see run_hash)
+	uint32_t		gx, gy;
+	uint32_t		nrows, ncols;	// of the image
+	uint32_t		tiledimX, tiledimY;
+	uint32_t		connectivity;
+	uint32_t		partition;
+	uint32_t		nobjects;		// of the shard
+	uint32_t		nrecords;		// tiles on the border of the block
+} seam_header;
+//	-header of the slice of final_parent of a shard (see shard_merge), followed by the global
+//	 ID of every object of the shard
+typedef struct {
+	char			magic[4];		// SLICE_MAGIC
+	uint32_t		shard;
+	uint64_t		run;
+	uint32_t		nobjects;		// of the image
+	uint32_t		nlocal;			// of the shard
+	char			out_file[4096];	// absolute path of the labels created by the merge
+} slice_header;
+//	-header of a tile in the cache (see cache_store)
+typedef struct {
+	char			magic[4];		// CACHE_MAGIC
+	uint32_t		nrows, ncols;	// of the tile and its halo, the pixels stored after the header
+	uint32_t		tiledimY, tiledimX;
+	uint32_t		last_r, last_c;	// last row/column owned by the tile
+	uint32_t		connectivity;
+	uint32_t		partition;		// 1 if the tiles partition the image (see -P), last field of CACHE_KEY
+	uint32_t		mc;				// compact labels
+	uint32_t		nbits;			// bits per label: 8, 16 or 32
+	uint32_t		has_stats;		// 1 if the statistics of the labels follow the pixels
+} cache_header;
+//	-TIFF tag, with values in host byte order
+typedef struct {
+	uint16_t		tag;
+	uint16_t		type;
+	uint64_t		count;
+	unsigned char	*value;
+} tiff_tag;
+//	-decoded strip/tile of a TIFF
+typedef struct {
+	pthread_mutex_t	lock;
+	int64_t			block;			// index of the strip/tile in buf (-1 if none)
+	unsigned char	*buf;
+} tiff_slot;
+//	-TIFF mapped in memory (see map_tiff)
+typedef struct {
+	void			*base;			// mapping of the whole file
+	size_t			size;
+	unsigned char	big_endian;
+	unsigned char	bigtiff;
+	unsigned int	nrows, ncols;	// size of the image (without padding)
+	unsigned int	block_w, block_h;	// size of tiles (strips are tiles as wide as the image)
+	unsigned int	blocks_across;
+	unsigned int	nblocks;
+	unsigned int	compression;
+	unsigned int	predictor;
+	uint64_t		*offsets;		// of every strip/tile
+	uint64_t		*bytecounts;
+	unsigned int	ngeo;
+	tiff_tag		geo[TIFF_MAX_GEO];	// georeferencing tags
+	tiff_slot		*cache;
+	unsigned int	nslots;
+} tiff_mat;
+//	-header of binary labels (see open_labels)
+typedef struct {
+	char			magic[4];		// LAB_MAGIC
+	uint32_t		nrows;
+	uint32_t		ncols;
+	uint32_t		nbits;			// bits per label: 16 or 32
+	uint32_t		nobjects;
+	uint32_t		nchunks;		// 0 if not compressed
+	uint32_t		rows_per_chunk;
+	uint32_t		reserved;
+} lab_header;
+//	-output labels being written
+typedef struct {
+	unsigned int	format;
+	FILE			*fid;			// OUT_TEXT
+	int				fd;				// OUT_BIN, OUT_ZBIN
+	unsigned int	nrows, ncols;
+	unsigned int	nbits;
+	unsigned int	rows_per_chunk;
+	unsigned int	nchunks;
+	unsigned char	compressed;
+	unsigned char	bigtiff;
+	uint64_t		*chunk_table;	// {offset,size} of every chunk
+	off_t			data_start;		// offset of the first row/chunk
+	off_t			next_offset;	// where the next chunk goes
+	tiff_mat		*geo;			// georeferencing of the output (OUT_TIFF, OUT_ZTIFF)
+	pthread_mutex_t	lock;
+} label_writer;
+//	-statistics of the provisional labels of the tile being scanned
+typedef struct {
+	comp_stats		*s;				// indexed by provisional label
+	packed_mat		halo;			// the tile and the next row/column, for the perimeter
+	unsigned int	row0, col0;		// pixel (0,0) of the tile in the padded image
+	unsigned int	first;			// 1: the first row/column of the tile belong to nn/ww, 0: all are owned (-P)
+	unsigned int	last_r, last_c;	// last row/column owned by the tile
+} tile_stats;
+//	-timings and counters of a tile (see trace_tiles)
+typedef struct {
+	double			first_scan;		// seconds
+	double			relabel;
+	double			second_scan;
+	unsigned int	provisional;	// labels of the first scan, out of nID
+	unsigned int	cached;			// 1 if read from the tile cache
+} tile_trace;
+//	-first scan kernel (see SCAN_KERNEL)
+typedef unsigned int (*scan_kernel)( SCAN_ARGS );
+//	-configuration of a labeling, carried by its tiles_job (from the command line, see cli_config,
+//	 or from the options of a library context, see ccl_label)
+typedef struct {
+	unsigned int	threads;		// workers of run_tiles
+	unsigned int	connectivity;	// of the objects: 8 or 4
+	unsigned int	partition;		// 1: tiles partition the image (see -P)
+	unsigned int	hierarchical;	// 1: merge the tile seams by levels of blocks
+	unsigned int	engine;			// SCAN_PIXELS or SCAN_RUNS
+	unsigned int	nbytes;			// per class of a multi-class image (see -M), 0 for a binary mask
+	scan_kernel		scan;			// first scan kernel (see pick_scan_kernel)
+	char			*cache_dir;		// tile cache (see cache_load), NULL if none
+} label_config;
+//	-classes of the padded image (multi-class labeling): pixel (r,c) is data[r*stride+c]
+typedef struct {
+	void			*data;
+	size_t			stride;			// pixels per row
+	unsigned int	nbytes;			// per pixel: 1 (uint8) or 2 (uint16)
+} class_mat;
+//	-all what the tile kernels need, shared by the workers of the thread pool
+typedef struct {
+	packed_mat		*mask;			// I: whole image (or band), padded: tiles are views of it
+	mapped_mat		*map;			// I: binary image mapped in memory, packed in mask by pack_tile_row
+	tiff_mat		*tiff;			// I: TIFF image, packed in mask by pack_tile_row
+	unsigned int	NR, NC;			// size of the padded image
+	unsigned int	mask_row0;		// row of the padded image at row 0 of mask
+	unsigned int	tiledimX, tiledimY;
+	unsigned int	ntilesX, ntilesY;
+	unsigned int	nID;			// numel of PARENT/count of every tile
+	unsigned int	**lab_mat;		// origin of every tile in the label raster
+	unsigned int	stride;			// row pitch of the label raster
+	unsigned int	*mc;
+	unsigned int	*dim_cum;
+	comp_stats		**stats;		// O: statistics of the (compact) labels of every tile, NULL if not wanted
+	unsigned int	*final_parent;
+	unsigned int	block;			// side (in tiles) of the sub-blocks merged by merge_block
+	label_writer	*writer;
+	tile_metrics	*metrics;		// O: partial landscape metrics of every tile, NULL if not wanted
+	unsigned int	nobjects;
+	unsigned int	win_size, win_step;	// moving windows (see window_row_metrics)
+	unsigned int	win_rows, win_cols;	// grid of windows
+	float			*windows;		// O: WIN_METRICS values of every window
+	class_mat		*classes;		// I: classes of the image (padded as mask), NULL for a binary mask
+	tile_trace		*trace;			// O: timings and counters of every tile (benchmark, -J), NULL if not wanted
+	uint32_t		*out;			// O: labels of the library, rows of out_stride labels (see ccl_label)
+	size_t			out_stride;
+	uint32_t		*col_dist;		// distance transform: rows to the nearest object pixel of the column (see distance_tile_column)
+	uint32_t		*col_near;		// and the row of that pixel, NULL if the nearest labels are not wanted
+	int				dist_fd;		// O: distances, -1 if not wanted
+	label_writer	*near;			// O: labels of the nearest objects, NULL if not wanted
+	label_config	cfg;			// of the labeling, the same for all the tiles
+	unsigned char	**scratch;		// first stage arena of every worker, no statistics (see ccl_label), NULL: worker_scratch
+	int				thread_error;	// of run_tiles in hierarchical_cross_equivalence, 0 if none (see ccl_label)
+} tiles_job;
+//	-context of the library (see connected_component_labeling.h)
+struct ccl_context {
+	ccl_options		opt;
+	tiles_job		job;			// tiles of the last mask, kept for the next one of the same size
+	packed_mat		mask;
+	unsigned int	rows, cols;		// of the last mask (0 if none)
+	unsigned char	**scratch;		// arenas of job.scratch, one per thread
+	unsigned int	keys;			// room of job.final_parent
+};
+//	-overlap between an object of the first epoch and one of the second (see update_labeling)
+typedef struct {
+	uint32_t		id0, id1;		// labels (of the tile or final) in the two epochs
+	uint64_t		n;				// pixels
+} overlap;
+//	-second epoch of the tiles (see update_tile_labeling)
+typedef struct {
+	tiles_job		*J;				// the tiles, with the mask of the second epoch
+	packed_mat		*prev_mask;		// mask of the first epoch
+	unsigned int	*labels;		// label raster of the tiles that changed
+	unsigned int	**prev_lab_mat;	// compact labels of the first epoch of every tile
+	unsigned char	*changed;		// 1 if the tile (halo included) differs between the epochs
+	tile_metrics	*prev_area;		// pixels of the labels of every tile in the two epochs (NULL:
+	tile_metrics	*area;			// no correspondence of the objects)
+	overlap			**overlaps;		// of the labels of the two epochs in the tiles that changed
+	unsigned int	*noverlaps;
+} update_job;
+//	-range of tiles owned by one worker: tiles [next,end) are still to be processed
+typedef struct {
+	pthread_mutex_t	lock;
+	unsigned int	next;
+	unsigned int	end;
+} tile_queue;
+typedef struct {
+	tile_queue		*queues;
+	unsigned int	nWorkers;
+	unsigned int	id;
+	void			(*kernel)(unsigned int iTile, void *job);
+	void			*job;
+} tile_worker_args;
 
 //---------------------------- FUNCTIONS PROTOTYPES
 // 	FIRST STAGE
-unsigned int first_scan( unsigned char *urban, unsigned int nrows, unsigned int ncols,unsigned int *lab_mat,unsigned int *count,unsigned int nID,unsigned int *PARENT);
-unsigned int *record_equivalence(unsigned int val1, unsigned int val2, unsigned int nID, unsigned int *PARENT);
-void union_equivalence(unsigned int nID, unsigned int *PARENT);
-unsigned int *relabel_equivalence(unsigned int nID, unsigned int maxcount, unsigned int *PARENT);
-void second_scan( unsigned int *lab_mat,unsigned int nrows,unsigned int ncols,unsigned int *PARENT );
+unsigned int first_scan( SCAN_ARGS );
+unsigned int first_scan_4( SCAN_ARGS );
+unsigned int first_scan_u8( SCAN_ARGS );
+unsigned int first_scan_4_u8( SCAN_ARGS );
+unsigned int first_scan_u16( SCAN_ARGS );
+unsigned int first_scan_4_u16( SCAN_ARGS );
+uint64_t row_mask( unsigned char *row, unsigned int n );
+unsigned int extract_runs( packed_mat *urban, unsigned int r, unsigned int *runs );
+unsigned int first_scan_runs( SCAN_ARGS );
+unsigned int first_scan_runs_4( SCAN_ARGS );
+scan_kernel pick_scan_kernel( unsigned int engine, unsigned int connectivity, unsigned int nbytes );
+label_config cli_config( unsigned int nbytes );
+void record_equivalence(unsigned int val1, unsigned int val2, unsigned int *PARENT);
+unsigned int relabel_equivalence(unsigned int maxcount, unsigned int *PARENT);
+void init_stats(comp_stats *s);
+void merge_stats(comp_stats *a, comp_stats *b);
+void count_pixel(comp_stats *s, unsigned int R, unsigned int C, unsigned int sides);
+void add_pixel_stats(tile_stats *ts, unsigned int label, unsigned int r, unsigned int c);
+void add_run_stats(tile_stats *ts, unsigned int label, unsigned int r, unsigned int s, unsigned int e);
+void compact_stats(comp_stats *s, unsigned int maxcount, unsigned int *PARENT);
+void reduce_stats(comp_stats *out, comp_stats *in, unsigned int n, unsigned int *final_id);
+void write_stats(char *filename, comp_stats *s, unsigned int nobjects, uint16_t *classes);
+void tile_metrics_sweep(tiles_job *J, unsigned int iTile, tile_metrics *m);
+void write_metrics(char *filename, tile_metrics *m, unsigned int nTiles, unsigned int *mc, unsigned int *dim_cum, unsigned int *final_parent, unsigned int nobjects, uint64_t npixels);
+void write_windows(char *filename, tiles_job *J);
+void second_scan( unsigned int *lab_mat,unsigned int nrows,unsigned int ncols,unsigned int stride,unsigned int *PARENT );
 void print_mat(unsigned char *u,unsigned int nrows,unsigned int ncols, char *Label);
 void print_vec( unsigned int *vec, unsigned int numel, unsigned char *Label );
-void read_mat(unsigned char *urban, unsigned int nrows, unsigned int ncols, char *filename);
-void write_mat(unsigned int **lab_mat, unsigned int nr, unsigned int nc, unsigned int ntilesX, unsigned int ntilesY, char *filename);
+int alloc_packed(packed_mat *P, unsigned int nrows, unsigned int ncols);
+void init_packed(packed_mat *P, unsigned int nrows, unsigned int ncols);
+packed_mat packed_view(packed_mat *P, unsigned int row0, unsigned int col0, unsigned int nrows, unsigned int ncols);
+uint64_t packed_word(packed_mat *P, unsigned int r, unsigned int c);
+void or_bits(packed_mat *P, unsigned int r, unsigned int c, uint64_t v, unsigned int n);
+void xor_bits(packed_mat *P, unsigned int r, unsigned int c, uint64_t v, unsigned int n);
+void pack_bytes(packed_mat *P, unsigned int r, unsigned int c, unsigned char *pixels, unsigned int n);
+void pack_bits(packed_mat *P, unsigned int r, unsigned int c, unsigned char *bits, unsigned int n);
+void read_mat(packed_mat *urban, char *filename);
+void read_rows(FILE *fid, packed_mat *urban, unsigned int row0, unsigned int NR);
+void write_mat(unsigned int **lab_mat, unsigned int nr, unsigned int nc, unsigned int stride, unsigned int ntilesX, unsigned int ntilesY, unsigned int NR, unsigned int NC, char *filename);
+unsigned int map_mat(char *filename, mapped_mat *map);
+void unmap_mat(mapped_mat *map);
+void pack_map(mapped_mat *map, packed_mat *urban, unsigned int row0, class_mat *K);
+void init_classes(class_mat *K, unsigned int nrows, unsigned int ncols, unsigned int nbytes);
+void pack_classes(packed_mat *P, unsigned int r, class_mat *K, unsigned int kr);
+void read_classes(packed_mat *urban, class_mat *K, char *filename);
+uint64_t tiff_get(tiff_mat *T, const unsigned char *p, unsigned int nbytes);
+void tiff_put(unsigned char *p, uint64_t v, unsigned int nbytes);
+unsigned int tiff_type_size(unsigned int type);
+unsigned int map_tiff(char *filename, tiff_mat *T);
+void open_tiff_cache(tiff_mat *T, unsigned int tiledimY);
+void unmap_tiff(tiff_mat *T);
+void tiff_decode_block(tiff_mat *T, unsigned int k, unsigned char *buf);
+void tiff_pack(tiff_mat *T, packed_mat *urban, unsigned int row0, class_mat *K);
+void open_labels(label_writer *W, char *filename, unsigned int nrows, unsigned int ncols, unsigned int nobjects, unsigned int rows_per_chunk, tiff_mat *geo);
+void write_labels(label_writer *W, unsigned int row0, unsigned int nrows, unsigned int *labels);
+void close_labels(label_writer *W);
+void write_tiff_ifd(label_writer *W);
+unsigned int tile_row_labels(tiles_job *J, unsigned int ntY, unsigned int *rows);
 
 // 	SECOND STAGE
-unsigned int *objects_stitching_nn(unsigned int *lm_nn,unsigned int *lm_cc,unsigned int nr,unsigned int nc,unsigned int ntile_nn,unsigned int ntile_cc,unsigned int *cross_parent);
-unsigned int *objects_stitching_ww(unsigned int *lm_ww,unsigned int *lm_cc,unsigned int nr,unsigned int nc,unsigned int ntile_ww,unsigned int ntile_cc,unsigned int *cross_parent);
-unsigned int *objects_stitching_cc(unsigned int *lm_cc,unsigned int nr,unsigned int nc,unsigned int ntile_cc,unsigned int *cross_parent,unsigned int *cross_parent_ii,unsigned int first_empty,unsigned int *PARENT,unsigned int maxcount);
-unsigned int *record_cross_equivalence(unsigned int **lm,unsigned int *cross_parent,unsigned int nr,unsigned int nc,unsigned int ntile_cc,int ntile_nn,int ntile_ww,unsigned int *PARENT,unsigned int mc);
-unsigned int  union_cross_equivalence(unsigned int first_empty, unsigned int *cross_parent);
-unsigned int *relabel_cross_equivalence(unsigned int *final_parent, unsigned int *cross_parent,unsigned int dim_cross,unsigned int nTiles,unsigned int *mc);
+void objects_stitching_nn(unsigned int *lm_nn,unsigned int *lm_cc,unsigned int nr,unsigned int nc,unsigned int stride,unsigned int dim_nn,unsigned int dim_cc,unsigned int *final_parent,const label_config *cfg);
+void objects_stitching_ww(unsigned int *lm_ww,unsigned int *lm_cc,unsigned int nr,unsigned int nc,unsigned int stride,unsigned int dim_ww,unsigned int dim_cc,unsigned int *final_parent,const label_config *cfg);
+void objects_stitching_corner(unsigned int *lm_nx,unsigned int *lm_cc,unsigned int east,unsigned int nr,unsigned int nc,unsigned int stride,unsigned int dim_nx,unsigned int dim_cc,unsigned int *final_parent,const label_config *cfg);
+void objects_stitching_cc(unsigned int dim_cc,unsigned int *final_parent,unsigned int maxcount);
+void record_cross_equivalence(unsigned int **lm,unsigned int *final_parent,unsigned int nr,unsigned int nc,unsigned int stride,unsigned int ntile_cc,int ntile_nn,int ntile_ww,unsigned int mc,unsigned int *dim_cum,const label_config *cfg);
+unsigned int relabel_cross_equivalence(unsigned int *final_parent,unsigned int dim);
 // 	THIRD STAGE
-unsigned int *third_scan(unsigned int	nrows, unsigned int	ncols, unsigned int	*lab_mat, unsigned int	*cur_final_parent);
+unsigned int *third_scan(unsigned int	nrows, unsigned int	ncols, unsigned int stride, unsigned int	*lab_mat, unsigned int	*cur_final_parent);
+// 	THREAD POOL
+void *worker_scratch( size_t size );
+void free_worker_scratch( void );
+unsigned int pop_tile( tile_queue *q, unsigned int *iTile );
+unsigned int steal_tiles( tile_queue *victim, tile_queue *thief );
+void *tile_worker( void *args );
+int run_tiles( unsigned int threads, unsigned int nTiles, void (*kernel)(unsigned int, void*), void *job );
+void pack_tile_row( unsigned int ntY, void *job );
+uint64_t tile_hash( packed_mat *P, cache_header *key );
+void cache_path( char *path, size_t len, char *dir, uint64_t hash );
+unsigned int cache_load( tiles_job *J, unsigned int iTile, packed_mat *halo, cache_header *key, uint64_t hash, unsigned int row0, unsigned int col0 );
+void cache_store( tiles_job *J, unsigned int iTile, packed_mat *halo, cache_header *key, uint64_t hash, unsigned int row0, unsigned int col0 );
+void intra_tile_labeling( unsigned int iTile, void *job );
+void final_tile_labeling( unsigned int iTile, void *job );
+void cross_tile_labeling( unsigned int iTile, void *job );
+void merge_block( unsigned int iBlock, void *job );
+void hierarchical_cross_equivalence( tiles_job *J );
+unsigned int cross_tile_equivalence( tiles_job *J );
+void write_tile_row( unsigned int ntY, void *job );
+void window_row_metrics( unsigned int iRow, void *job );
+void sweep_tile_metrics( unsigned int iTile, void *job );
+uint16_t *object_classes( tiles_job *J, unsigned int nobjects );
+// 	TWO EPOCHS
+unsigned int same_packed( packed_mat *a, packed_mat *b );
+int cmp_uint64( const void *a, const void *b );
+int cmp_overlap( const void *a, const void *b );
+void update_tile_labeling( unsigned int iTile, void *job );
+unsigned int update_labeling( tiles_job *J, packed_mat *mask1, char *changes_file, unsigned int **labels1 );
+void write_changes( char *filename, overlap *ov, size_t n, unsigned int nobj0, unsigned int nobj1, uint64_t *area0, uint64_t *area1 );
+// 	FILTERING
+unsigned int filter_objects( comp_stats *s, unsigned int nobjects, unsigned int min_area, unsigned int largest, unsigned int *final_parent, unsigned int dim );
+void filter_tile_row( unsigned int ntY, void *job );
+void invert_image( packed_mat *mask, unsigned int NR, unsigned int NC );
+unsigned int fill_holes( tiles_job *J, unsigned int hole_area );
+// 	DISTANCE TRANSFORM
+void distance_tile_column( unsigned int ntX, void *job );
+void distance_tile_row( unsigned int ntY, void *job );
+void distance_transform( tiles_job *J, char *dist_file, char *near_file );
+// 	STREAMING
+void stream_labeling( char *in_file, mapped_mat *map, tiff_mat *tiff, char *out_file, char *spill_file, char *stats_file, unsigned int tiledimX, unsigned int tiledimY, unsigned int NR, unsigned int NC, unsigned int ntilesX, unsigned int ntilesY, unsigned int nID, const label_config *cfg );
+// 	SHARDING
+void shard_path( char *path, size_t len, char *shard_dir, unsigned int shard, char *ext );
+uint64_t run_hash( char *token );
+void shard_abort( void );
+FILE *wait_file( char *path, char *magic, uint64_t run );
+void shard_write( char *path, void *header, size_t hsize, uint32_t **data, size_t *n, unsigned int ndata );
+void shard_tiles( unsigned int shard, unsigned int gx, unsigned int gy, unsigned int ntilesX, unsigned int ntilesY, unsigned int *bx0, unsigned int *bx1, unsigned int *by0, unsigned int *by1 );
+void shard_labeling( mapped_mat *map, tiff_mat *tiff, char *shard_dir, uint64_t run, unsigned int shard, unsigned int gx, unsigned int gy, unsigned int tiledimX, unsigned int tiledimY, unsigned int NR, unsigned int NC, unsigned int ntilesX, unsigned int ntilesY, unsigned int nID, const label_config *cfg );
+unsigned int shard_merge( char *shard_dir, char *out_file, uint64_t run );
+// 	TILING
+size_t cache_size( unsigned int level );
+void auto_tile_size( unsigned int NR1, unsigned int NC1, unsigned int bytes, unsigned int threads, unsigned int *tiledimX, unsigned int *tiledimY );
+unsigned int tile_nID( unsigned int tiledimX, unsigned int tiledimY, const label_config *cfg );
+int init_tiles( tiles_job *J, packed_mat *mask, unsigned int NR1, unsigned int NC1, unsigned int tiledimX, unsigned int tiledimY, const label_config *cfg );
+void free_tiles( tiles_job *J );
+// 	BENCHMARK
+double wall_time( void );
+uint64_t bench_hash( uint64_t x );
+double bench_noise( unsigned int r, unsigned int c, unsigned int cell, uint64_t seed );
+void bench_mask( unsigned char *pixels, unsigned int NR1, unsigned int NC1, unsigned int pattern, double density, uint64_t seed );
+void benchmark( char *bench_file, unsigned int tiledimX, unsigned int tiledimY, unsigned int NR1, unsigned int NC1 );
+// 	VERIFICATION
+unsigned int bfs_labels( uint16_t *pixels, unsigned int NR1, unsigned int NC1, unsigned int *labels );
+unsigned int same_partition( unsigned int *a, unsigned int *b, size_t n, unsigned int na, unsigned int nb );
+unsigned int verify( unsigned int rounds );
+// 	INSTRUMENTATION
+double trace_stage( const char *stage, double t0 );
+void trace_tiles( tiles_job *J, unsigned int ntY0 );
+void trace_cross( tiles_job *J, unsigned int nobjects );
+void trace_summary( tiles_job *J, unsigned int nobjects, double t0 );
+// 	LIBRARY (see connected_component_labeling.h)
+void library_tile_labeling( unsigned int iTile, void *job );
+void ccl_reset( ccl_context *ctx );
+void print_usage( char *prog );
 //---------------------------- FUNCTIONS PROTOTYPES
 
 
@@ -79,204 +688,576 @@ unsigned int *third_scan(unsigned int	nrows, unsigned int	ncols, unsigned int	*l
 	how many rows: (ntiles * 2 + ntilesX + ntilesY) *  ((tiledimX+tiledimY)/2)
 */
 
-unsigned int first_scan(
-				unsigned char	*urban,
-				unsigned int	nrows,
-				unsigned int	ncols,
-				unsigned int	*lab_mat,
-				unsigned int	*count,
-				unsigned int 	nID,
-				unsigned int	*PARENT		)
+static inline __attribute__((always_inline)) unsigned int scan_pixels(
+				packed_mat		*urban,
+				const void		*classes,	// class of pixel (0,0) of the tile (NBYTES>0)
+				size_t			cstride,	// row pitch of the classes
+				unsigned int	*lab_mat,	// origin of the tile in the label raster
+				unsigned int	stride,		// row pitch of the label raster
+				unsigned int	*PARENT,
+				unsigned int	*work,		// unused
+				tile_stats		*ts,		// statistics of the labels (NULL: none)
+				const unsigned int CONN,	// 8 or 4
+				const unsigned int NBYTES	)	// 0: binary mask, 1/2: uint8/uint16 classes
 {
+	/*
+	 *	Pixel engine of the first scan kernels (see SCAN_KERNEL): CONN and NBYTES are
+	 *	constants in every kernel, so the tests on them are folded at compile time and
+	 *	each kernel has the inner loop of its own mode only.
+	 */
+	(void)work;
+	unsigned int nrows	= urban->nrows;
+	unsigned int ncols	= urban->ncols;
 	unsigned int r		= 0;
 	unsigned int c		= 0;
+	unsigned int c0		= 0;
+	unsigned int k		= 0;	// class of (r,c)
 	unsigned int maxcount	= 0;	
+	uint64_t w;
 	for(r=0; r<nrows; r++)
 	{
-		for(c=0; c<ncols; c++)
+		for(c0=0; c0<ncols; c0+=64)
 		{
-			if(durban(c,r)==Vo) // if (r,c) is object pixel 
+			// only object pixels are visited: a word of background is skipped at once
+			for(w=packed_word(urban,r,c0); w; w&=w-1) // (r,c) is object pixel 
 			{
-				/*
-				 * 	We use the so called "forward scan mask"
-				 * 	in which only four adjacent pixels are considered:
-				 * 		{ ww, nw, nn, ne }
-				 */
-				// NORTH:
-				if(r>0 && nn_pol(c,r)!=Vb) cc_pol(c,r) = nn_pol(c,r);
-				
-				// WEST:
-				else if(c>0 && ww_pol(c,r)!=Vb)
+				c = c0 + __builtin_ctzll(w);
+				if(NBYTES) k = cls_pol(c,r);
+				if(CONN==8)
 				{
-					cc_pol(c,r) = ww_pol(c,r);
-					if (c<ncols-1 && r>0 && ne_pol(c,r)!=Vb) PARENT = record_equivalence( ne_pol(c,r), ww_pol(c,r), nID, PARENT );
+					/*
+					 * 	We use the so called "forward scan mask"
+					 * 	in which only four adjacent pixels are considered:
+					 * 		{ ww, nw, nn, ne }
+					 */
+					// NORTH:
+					if(r>0 && joins(0,-1)) cc_pol(c,r) = nn_pol(c,r);
+					
+					// WEST:
+					else if(c>0 && joins(-1,0))
+					{
+						cc_pol(c,r) = ww_pol(c,r);
+						if (c<ncols-1 && r>0 && joins(+1,-1)) record_equivalence( ne_pol(c,r), ww_pol(c,r), PARENT );
+					}
+					
+					// NORTH-WEST:
+					else if(r>0 && c>0 && joins(-1,-1))
+					{
+						cc_pol(c,r) = nw_pol(c,r);
+						if ( c<ncols-1 && joins(+1,-1) ) record_equivalence( ne_pol(c,r), nw_pol(c,r), PARENT );
+					}
+					
+					// NORTH-EAST:
+					else if(r>0 && c<ncols-1 && joins(+1,-1)) cc_pol(c,r) = ne_pol(c,r);
+					
+					//none object pixels in mask:
+					else
+					{
+						cc_pol(c,r) = ++maxcount;
+						PARENT[maxcount] = maxcount;	// every new label is the ROOT of its own set
+						if(ts!=NULL) init_stats( &ts->s[maxcount] );
+					}
 				}
-				
-				// NORTH-WEST:
-				else if(r>0 && c>0 && nw_pol(c,r)!=Vb)
+				else
 				{
-					cc_pol(c,r) = nw_pol(c,r);
-					if ( c<ncols-1 && ne_pol(c,r)!=Vb ) PARENT = record_equivalence( ne_pol(c,r), nw_pol(c,r), nID, PARENT );
+					/*
+					 * 	4-connectivity: the mask is { ww, nn }, which are not
+					 * 	adjacent to each other, so both may have to be joined.
+					 */
+					// NORTH:
+					if(r>0 && joins(0,-1))
+					{
+						cc_pol(c,r) = nn_pol(c,r);
+						if (c>0 && joins(-1,0) && ww_pol(c,r)!=nn_pol(c,r)) record_equivalence( ww_pol(c,r), nn_pol(c,r), PARENT );
+					}
+					
+					// WEST:
+					else if(c>0 && joins(-1,0)) cc_pol(c,r) = ww_pol(c,r);
+					
+					//none object pixels in mask:
+					else
+					{
+						cc_pol(c,r) = ++maxcount;
+						PARENT[maxcount] = maxcount;	// every new label is the ROOT of its own set
+						if(ts!=NULL) init_stats( &ts->s[maxcount] );
+					}
 				}
 				
-				// NORTH-EAST:
-				else if(r>0 && c<ncols-1 && ne_pol(c,r)!=Vb) cc_pol(c,r) = ne_pol(c,r);
-				
-				//none object pixels in mask:
-				else
-					cc_pol(c,r) = ++maxcount;
-				
-				// I am not sure that we should count right NOW.
-				// Maybe It could be better to performe this is a separate phase when all 
-				// equivalent labels are already known and applied.
-				count[cc_pol(c,r)]++;
+				// statistics go with the provisional label, they are reduced together
+				// with the equivalences (see compact_stats and reduce_stats)
+				if(ts!=NULL)
+				{
+					if(!NBYTES) add_pixel_stats( ts, cc_pol(c,r), r, c );
+					// with classes the perimeter counts the sides facing another class
+					else if( r>0 && c>0 && r<=ts->last_r && c<=ts->last_c )
+						count_pixel( &ts->s[cc_pol(c,r)], ts->row0+r-1, ts->col0+c-1,
+									 (cls_pol(c,r-1)!=k) + (cls_pol(c,r+1)!=k) + (cls_pol(c-1,r)!=k) + (cls_pol(c+1,r)!=k) );
+				}
 			}
 		}
 	}	
 	return maxcount;
 }
 
-unsigned int * record_equivalence(unsigned int val1, unsigned int val2, unsigned int nID, unsigned int *PARENT)
+uint64_t row_mask( unsigned char *row, unsigned int n )
 {
-	int skip = 0;
-	int i,k;
-	if(val1!=val2) // write equivalence only if values are different
-	{	// check if equivalence was already written
-		for (i=nID-1;i>=0;i--)
-		{
-			//printf("PARENT[%d,1:2]=(%d,%d)\t\tequivalence=(%d,%d)\n",i,PARENT[i*2+0],PARENT[i*2+1],_max(val1,val2),_min(val1,val2));
-			if( (PARENT[i*2+0] == (int)fmax((float)val1,(float)val2)) && (PARENT[i*2+1] == (int)fmin((float)val1,(float)val2)) )
-			{
-				skip = 1;
-			}
-			if(PARENT[i*2+0]==0) k=i;
-		}
-		if( skip==0 ) // write new equivalence only if it is not duplicated
+	/*
+	 *	Bit i of the mask is set if row[i] is an object pixel (n<=64), to pack a row
+	 *	of one byte per pixel. Full words are compared 16/32 pixels at a time
+	 *	(compare + movemask).
+	 */
+	uint64_t m=0;
+	unsigned int i;
+#if defined(__AVX2__)
+	if(n==64)
+	{
+		__m256i vo = _mm256_set1_epi8((char)Vo);
+		m  = (uint32_t)_mm256_movemask_epi8( _mm256_cmpeq_epi8( _mm256_loadu_si256((__m256i*)(row+ 0)), vo ) );
+		m |= (uint64_t)(uint32_t)_mm256_movemask_epi8( _mm256_cmpeq_epi8( _mm256_loadu_si256((__m256i*)(row+32)), vo ) ) << 32;
+		return m;
+	}
+#elif defined(__SSE2__)
+	if(n==64)
+	{
+		__m128i vo = _mm_set1_epi8((char)Vo);
+		for(i=0;i<4;i++) m |= (uint64_t)(uint16_t)_mm_movemask_epi8( _mm_cmpeq_epi8( _mm_loadu_si128((__m128i*)(row+16*i)), vo ) ) << (16*i);
+		return m;
+	}
+#endif
+	for(i=0;i<n;i++) m |= (uint64_t)(row[i]==Vo) << i;
+	return m;
+}
+
+unsigned int extract_runs( packed_mat *urban, unsigned int r, unsigned int *runs )
+{
+	/*
+	 *	Store the foreground runs of row r as {start,end} pairs (end excluded) in runs
+	 *	and return their number. The bits of m^(m<<1) mark where a run starts or
+	 *	ends, so they are visited by tzcnt without testing every pixel.
+	 */
+	unsigned int c0, n=0, ncols=urban->ncols;
+	uint64_t m, t, carry=0;
+	for(c0=0;c0<ncols;c0+=64)
+	{
+		m		= packed_word( urban, r, c0 );
+		t		= m ^ ((m<<1) | carry);
+		carry	= m>>63;
+		while(t)
 		{
-			/*
-			*PARENT++ = (int)fmax((float)val1,(float)val2);
-			*PARENT++ = (int)fmin((float)val1,(float)val2);
-			*/
-			PARENT[k*2+0] = (int)fmax((float)val1,(float)val2);
-			PARENT[k*2+1] = (int)fmin((float)val1,(float)val2);
-			//printf("PARENT[%d,1:2]=(%d,%d)\n",k,PARENT[k*2+0],PARENT[k*2+1]);
+			runs[n++] = c0 + __builtin_ctzll(t);
+			t &= t-1;
 		}
 	}
-	return PARENT;
+	if(n&1) runs[n++] = ncols; // run reaching the end of a row of 64*k pixels
+	return n/2;
 }
 
-void union_equivalence(unsigned int nID, unsigned int *PARENT)
+static inline __attribute__((always_inline)) unsigned int scan_runs(
+				packed_mat		*urban,
+				const void		*classes,		// unused: runs are of a binary mask
+				size_t			cstride,
+				unsigned int	*lab_mat,
+				unsigned int	stride,
+				unsigned int	*PARENT,
+				unsigned int	*work,			// room for 3*ncols+6 values
+				tile_stats		*ts,
+				const unsigned int CONN		)	// 8 or 4
 {
-	unsigned int j,k,*list_convergent_equivalence;
-	int found_combined_equivalence=1;
-
-	//printf("\n\nUNION_EQUIVALENCE:\n");
-
-	// (A) compare left-hand side on "j" with left-hand side on "k"  ==> SPLIT COMBINED EQUIVALENCES
-	while(found_combined_equivalence==1)
+	/*
+	 *	Same as scan_pixels, but by runs: a run takes the label of the first run of the
+	 *	previous row touching it (the 8-connectivity extends runs by one pixel on both
+	 *	sides, the 4-connectivity wants them to share a column) and records its
+	 *	equivalence with the others, or a new label if none.
+	 *	New labels are still given in raster order of the first pixel of the objects,
+	 *	hence relabel_equivalence yields the same IDs as after scan_pixels.
+	 */
+	(void)classes;
+	(void)cstride;
+	unsigned int nrows = urban->nrows, ncols = urban->ncols;
+	unsigned int r, i, j, k, c, s, e, label;
+	unsigned int np=0, nc, maxcount=0;
+	unsigned int *prev		= work;
+	unsigned int *cur		= prev + ncols+2;
+	unsigned int *prev_lab	= cur + ncols+2;
+	unsigned int *cur_lab	= prev_lab + ncols/2+1;
+	unsigned int *swap;
+	for(r=0; r<nrows; r++)
 	{
-		found_combined_equivalence = 0;
-		for(j=0;j<nID;j++)
+		nc = extract_runs( urban, r, cur );
+		for(i=0,k=0; i<nc; i++)
 		{
-			if(PARENT[j*2+0]==0) break; // It stops when the first zero on the left-hand side on "j" is found.
-
-			list_convergent_equivalence = (unsigned int*)calloc(nID*2,sizeof(unsigned int));
-			int cRow = 0;
-			int root_eq = nID;
-			for(k=j;k<nID;k++) // create a list of ID's with same left-hand side ID.
+			s = cur[2*i]; e = cur[2*i+1];
+			while(k<np && prev[2*k+1]<s+(CONN==4)) k++;	// runs of the previous row ending before nw (nn)
+			label = 0;
+			for(j=k; j<np && prev[2*j]<e+(CONN==8); j++)	// runs starting up to ne (nn)
 			{
-				if(PARENT[k*2+0]==0) break;
-				if( (PARENT[j*2+0]==PARENT[k*2+0]) ) // If a same ID is found on the left column on "j" and "k"...
-				{
-					if( (j!=k) && (PARENT[j*2+1]!=PARENT[k*2+1]) ) found_combined_equivalence = 1; // It is true only if I'm on different rows of PARENT and right-hand side is different (otherwise endless while loop)
-					list_convergent_equivalence[2*cRow +0] = k;				// ...record "k" position and
-					list_convergent_equivalence[2*cRow +1] = PARENT[k*2+1]; // ...record right-hand side ID on "k"
-					root_eq = fmin((float)root_eq,(float)PARENT[k*2+1]);
-					cRow+=1;
-				}
+				if(!label) label = prev_lab[j];
+				else record_equivalence( prev_lab[j], label, PARENT );
 			}
-			for(k=0;k<cRow;k++) // split equivalences
+			if(!label)
 			{
-				if(list_convergent_equivalence[2*k +1]!=root_eq) // decode equivalence only if it does not contain the "root_eq" of the current list
-				{
-					//printf("PARENT[%d,1:2]=(%d,%d)\t--->\t",k,PARENT[(list_convergent_equivalence[2*k +0])*2+0],PARENT[(list_convergent_equivalence[2*k +0])*2+1]);
-					PARENT[(list_convergent_equivalence[2*k +0])*2+0] = list_convergent_equivalence[2*k +1];
-					PARENT[(list_convergent_equivalence[2*k +0])*2+1] = root_eq;
-					//printf("PARENT[%d,1:2]=(%d,%d)\n",k,PARENT[(list_convergent_equivalence[2*k +0])*2+0],PARENT[(list_convergent_equivalence[2*k +0])*2+1]);
-				}
+				label = ++maxcount;
+				PARENT[maxcount] = maxcount;	// every new label is the ROOT of its own set
+				if(ts!=NULL) init_stats( &ts->s[maxcount] );
 			}
-			if(found_combined_equivalence==1) break;
+			for(c=s;c<e;c++) cc_pol(c,r) = label;
+			if(ts!=NULL) add_run_stats( ts, label, r, s, e );
+			cur_lab[i] = label;
+		}
+		swap = prev; prev = cur; cur = swap;
+		swap = prev_lab; prev_lab = cur_lab; cur_lab = swap;
+		np = nc;
+	}
+	return maxcount;
+}
+
+/*
+ *	FIRST SCAN KERNELS, one per connectivity and pixel type, all with the signature of
+ *	scan_kernel: the engines above are inlined with constant arguments, that is the
+ *	kernels are specialized at compile time (no test on the mode in the inner loop,
+ *	first_scan is the 8-connected binary scan as it was). The kernel is chosen once
+ *	per labeling (see pick_scan_kernel) and called through label_config.
+ */
+SCAN_KERNEL( first_scan,		scan_pixels,	8, 0 )	// binary mask
+SCAN_KERNEL( first_scan_4,		scan_pixels,	4, 0 )
+SCAN_KERNEL( first_scan_u8,		scan_pixels,	8, 1 )	// uint8 classes
+SCAN_KERNEL( first_scan_4_u8,	scan_pixels,	4, 1 )
+SCAN_KERNEL( first_scan_u16,	scan_pixels,	8, 2 )	// uint16 classes
+SCAN_KERNEL( first_scan_4_u16,	scan_pixels,	4, 2 )
+SCAN_KERNEL( first_scan_runs,	scan_runs,		8 )		// binary mask, by runs
+SCAN_KERNEL( first_scan_runs_4,	scan_runs,		4 )
+
+scan_kernel pick_scan_kernel( unsigned int engine, unsigned int connectivity, unsigned int nbytes )
+{
+	// the first scan kernel of the engine and connectivity, for classes of nbytes (0 for a binary mask)
+	if( engine==SCAN_RUNS )			return (connectivity==8) ? first_scan_runs : first_scan_runs_4;
+	else if( nbytes==0 )			return (connectivity==8) ? first_scan : first_scan_4;
+	else if( nbytes==1 )			return (connectivity==8) ? first_scan_u8 : first_scan_4_u8;
+	else							return (connectivity==8) ? first_scan_u16 : first_scan_4_u16;
+}
+
+label_config cli_config( unsigned int nbytes )
+{
+	// the configuration of the command line, for classes of nbytes if multi_class
+	label_config cfg;
+	cfg.threads			= nThreads;
+	cfg.connectivity	= connectivity;
+	cfg.partition		= partition;
+	cfg.hierarchical	= hierarchical;
+	cfg.engine			= scan_engine;
+	cfg.nbytes			= multi_class ? nbytes : 0;
+	cfg.scan			= pick_scan_kernel( cfg.engine, cfg.connectivity, cfg.nbytes );
+	cfg.cache_dir		= cache_dir;
+	return cfg;
+}
+
+/*
+ *	The equivalence table is a union-find forest stored in PARENT and indexed by
+ *	provisional label: PARENT[label] is the parent of label and a ROOT satisfies
+ *	PARENT[root]==root. Trees are merged by Rem's algorithm (union with splicing)
+ *	always linking towards the smaller label, so that PARENT[label]<=label holds
+ *	and the ROOT of every set is its minimum label.
+ */
+void record_equivalence(unsigned int val1, unsigned int val2, unsigned int *PARENT)
+{
+	unsigned int z;
+	while(PARENT[val1]!=PARENT[val2])
+	{
+		if(PARENT[val1]>PARENT[val2])
+		{
+			if(val1==PARENT[val1]) { PARENT[val1] = PARENT[val2]; return; }
+			z = PARENT[val1]; PARENT[val1] = PARENT[val2]; val1 = z;	// splicing
+		}
+		else
+		{
+			if(val2==PARENT[val2]) { PARENT[val2] = PARENT[val1]; return; }
+			z = PARENT[val2]; PARENT[val2] = PARENT[val1]; val2 = z;	// splicing
 		}
 	}
-	// ----(A)----
 }
 
-unsigned int *relabel_equivalence(unsigned int nID, unsigned int maxcount, unsigned int *PARENT)
+unsigned int relabel_equivalence(unsigned int maxcount, unsigned int *PARENT)
 {
 	/*
-	 *
+	 *	Flatten the forest: since PARENT[j]<=j, visiting labels in increasing
+	 *	order guarantees that PARENT[j] was already replaced by the ID of its ROOT.
+	 *	ROOTs are given consecutive IDs on the way (COMPACT), so the tile labels have
+	 *	no gaps and keep the order of their ROOTs. It returns the number of objects.
+	 */
+	unsigned int j,nroots=0;
+	PARENT[0] = 0; // background
+	for(j=1;j<=maxcount;j++) PARENT[j] = (PARENT[j]==j) ? ++nroots : PARENT[PARENT[j]];
+	return nroots;
+}
+
+void init_stats(comp_stats *s)
+{
+	memset(s,0,sizeof(comp_stats));
+	s->min_r = s->min_c = UINT32_MAX;
+}
+
+void merge_stats(comp_stats *a, comp_stats *b)
+{
+	// a <- a U b
+	a->area			+= b->area;
+	a->perimeter	+= b->perimeter;
+	a->sum_r		+= b->sum_r;
+	a->sum_c		+= b->sum_c;
+	a->min_r		= _min( a->min_r, b->min_r );
+	a->min_c		= _min( a->min_c, b->min_c );
+	a->max_r		= _max( a->max_r, b->max_r );
+	a->max_c		= _max( a->max_c, b->max_c );
+}
+
+void count_pixel(comp_stats *s, unsigned int R, unsigned int C, unsigned int sides)
+{
+	// add pixel (R,C) of the image, with sides on the perimeter, to s
+	s->area++;
+	s->sum_r		+= R;
+	s->sum_c		+= C;
+	s->min_r		= _min( s->min_r, R );
+	s->min_c		= _min( s->min_c, C );
+	s->max_r		= _max( s->max_r, R );
+	s->max_c		= _max( s->max_c, C );
+	s->perimeter	+= sides;
+}
+
+void add_pixel_stats(tile_stats *ts, unsigned int label, unsigned int r, unsigned int c)
+{
+	/*
+	 *	Add pixel (r,c) of the tile to the statistics of its provisional label, if the
+	 *	tile owns it: the first row/column belong to the nn/ww tiles, as in write_mat
+	 *	(but with -P, where the tile scanned is the part it owns). The perimeter counts
+	 *	the sides facing background (4-neighbours), whatever tile the neighbour belongs to.
 	 */
-	int cc;
-	int j,k,dependent_id;
-	unsigned int *new_PARENT;
-	new_PARENT = (unsigned int*)calloc(nID*2,sizeof(unsigned int));
+	unsigned int h = 1-ts->first;	// (r,c) is (r+h,c+h) of the halo
+	if( r<ts->first || c<ts->first || r>ts->last_r || c>ts->last_c ) return;
+	count_pixel( &ts->s[label], ts->row0+r-ts->first, ts->col0+c-ts->first,	// in the image
+				 !packed_bit(&ts->halo,r+h-1,c+h) + !packed_bit(&ts->halo,r+h+1,c+h) + !packed_bit(&ts->halo,r+h,c+h-1) + !packed_bit(&ts->halo,r+h,c+h+1) );
+}
+
+void add_run_stats(tile_stats *ts, unsigned int label, unsigned int r, unsigned int s, unsigned int e)
+{
+	/*
+	 *	As add_pixel_stats for the run [s,e) of row r: the sides facing background above
+	 *	and below are counted a word at a time, the run ends are background on the left
+	 *	and, but at the last column of the tile, on the right.
+	 */
+	comp_stats		*st = &ts->s[label];
+	unsigned int	a, b, i, n, m, R, C, h = 1-ts->first;
+	uint64_t		mask;
+	if( r<ts->first || r>ts->last_r ) return;
+	a = _max( s, ts->first );
+	b = _min( e, ts->last_c+1 );
+	if( a>=b ) return;
+	n = b-a;
+	R = ts->row0+r-ts->first;	C = ts->col0+a-ts->first;	// in the image
+	st->area		+= n;
+	st->sum_r		+= (uint64_t)n*R;
+	st->sum_c		+= (uint64_t)n*C + (uint64_t)n*(n-1)/2;
+	st->min_r		= _min( st->min_r, R );
+	st->min_c		= _min( st->min_c, C );
+	st->max_r		= _max( st->max_r, R );
+	st->max_c		= _max( st->max_c, C+n-1 );
+	for(i=0;i<n;i+=64)
+	{
+		m		= (n-i<64) ? n-i : 64;
+		mask	= (m<64) ? ((uint64_t)1<<m)-1 : ~(uint64_t)0;
+		st->perimeter += __builtin_popcountll( ~packed_word(&ts->halo,r+h-1,a+h+i) & mask )
+					   + __builtin_popcountll( ~packed_word(&ts->halo,r+h+1,a+h+i) & mask );
+	}
+	if( a==s && (s>0 || !packed_bit(&ts->halo,r+h,h-1)) ) st->perimeter++;	// s=0 only with -P
+	if( b==e && !packed_bit(&ts->halo,r+h,e+h) ) st->perimeter++;
+}
 
-	//printf("\n\nRE-LABEL EQUIVALENCE:\n");
+void compact_stats(comp_stats *s, unsigned int maxcount, unsigned int *PARENT)
+{
+	/*
+	 *	Reduce the statistics of the provisional labels to the compact labels given by
+	 *	relabel_equivalence, in place (s[l-1] ends up with compact label l). Compact IDs
+	 *	are given in increasing order of ROOT, which is the first label of its set:
+	 *	the first time an ID shows up it is its ROOT, whose slot is no longer needed.
+	 */
+	unsigned int j, next=1;
+	for(j=1;j<=maxcount;j++)
+	{
+		if( PARENT[j]==next )	{ s[next-1] = s[j]; next++; }
+		else					merge_stats( &s[PARENT[j]-1], &s[j] );
+	}
+}
+
+void reduce_stats(comp_stats *out, comp_stats *in, unsigned int n, unsigned int *final_id)
+{
+	// merge in[i] in the statistics of object final_id[i] (out[0] is background)
+	unsigned int i;
+	for(i=0;i<n;i++) merge_stats( &out[final_id[i]], &in[i] );
+}
 
-	// (B) compare left-hand side on "j" with right-hand side on "k" ==> ASSIGN ROOT EQUIVALENCE
-	cc=1;
-	while (cc)
-	{	cc=0;
-		for(j=0;j<nID;j++)
+void write_stats(char *filename, comp_stats *s, unsigned int nobjects, uint16_t *classes)
+{
+	/*
+	 *	Write the statistics of objects 1..nobjects (s[1..nobjects]) in image coordinates:
+	 *	as CSV if filename ends with ".csv", otherwise as stats_header followed by one
+	 *	comp_stats per object (the centroid is {sum_r,sum_c}/area). The class of every
+	 *	object (classes[1..nobjects], if not NULL) is one more column, or follows the records.
+	 */
+	unsigned int	id;
+	size_t			len = strlen(filename);
+	FILE			*fid;
+	stats_header	h = { STATS_MAGIC, nobjects, sizeof(comp_stats), classes!=NULL };
+	fid = fopen(filename,"wb");
+	if (fid == NULL) { printf("Error opening file %s!\n",filename); exit(1); }
+	if( len>=4 && !strcmp(filename+len-4,".csv") )
+	{
+		fprintf(fid,"id,area,perimeter,row_min,col_min,row_max,col_max,centroid_row,centroid_col%s\n", classes ? ",class" : "");
+		for(id=1;id<=nobjects;id++)
 		{
-			if(PARENT[j*2+0]==0) break; // It stops when the first zero on the left-hand side on "j" is found.
-			for(k=0;k<nID;k++)
-			{
-				if(PARENT[j*2+1]==PARENT[k*2+0])
-				{
-					PARENT[j*2+1]=PARENT[k*2+1];
-					cc=1;
-				}
-			}
-	// ----(B)----
+			fprintf(fid,"%u,%llu,%llu,%u,%u,%u,%u,%.3f,%.3f", id,
+					(unsigned long long)s[id].area, (unsigned long long)s[id].perimeter,
+					s[id].min_r, s[id].min_c, s[id].max_r, s[id].max_c,
+					(double)s[id].sum_r/s[id].area, (double)s[id].sum_c/s[id].area );
+			if( classes!=NULL ) fprintf(fid,",%u",classes[id]);
+			fprintf(fid,"\n");
 		}
 	}
-	// (C) delete duplicates, sort IDs, define also ROOT equivalences!
-	for(j=0;j<=maxcount;j++)
+	else
 	{
-		dependent_id = 0;
-		for(k=0;k<nID;k++)
+		if( fwrite(&h,sizeof(h),1,fid)!=1 || fwrite(s+1,sizeof(comp_stats),nobjects,fid)!=nobjects
+			|| (classes!=NULL && fwrite(classes+1,sizeof(uint16_t),nobjects,fid)!=nobjects) )
+		{ printf("Error writing file %s!\n",filename); exit(1); }
+	}
+	fclose(fid);
+}
+
+void tile_metrics_sweep(tiles_job *J, unsigned int iTile, tile_metrics *m)
+{
+	/*
+	 *	Partial landscape metrics of a tile, swept on its compact labels (before
+	 *	third_scan): pixels of every label, object pixels and sides between object and
+	 *	background. Only the pixels owned by the tile are swept (as in write_mat), and of
+	 *	every pixel only the sides towards north and west, so that seams and sides are
+	 *	counted once in the image. Sides on the border of the image are not edges.
+	 *	Object pixels and sides are counted on the mask, 64 pixels at a time, and only
+	 *	the object pixels read their label.
+	 */
+	unsigned int	*lab_mat = J->lab_mat[iTile];
+	unsigned int	stride = J->stride;
+	unsigned int	row0 = (iTile/J->ntilesX)*(J->tiledimY-1), col0 = (iTile%J->ntilesX)*(J->tiledimX-1);
+	unsigned int	last_r = _min( J->tiledimY-1, J->NR-2-row0 );
+	unsigned int	last_c = _min( J->tiledimX-1, J->NC-2-col0 );
+	unsigned int	r, c, n;
+	uint64_t		w, bits;
+	packed_mat		tile = packed_view(J->mask, row0, col0, last_r+1, last_c+1);
+	m->area		= (uint32_t*)calloc(_max(J->mc[iTile],1),sizeof(uint32_t));
+	if (m->area == NULL) { printf("Error allocating the metrics!\n"); exit(1); }
+	m->sealed	= 0;
+	m->edges	= 0;
+	for(r=1;r<=last_r;r++)
+		for(c=1;c<=last_c;c+=64)
 		{
-			if( PARENT[k*2+0]==j )
+			n		= _min( 64, last_c+1-c );
+			bits	= (n<64) ? ((uint64_t)1<<n)-1 : ~(uint64_t)0;
+			w		= packed_word(&tile,r,c);
+			m->sealed += __builtin_popcountll( w );
+			if( row0+r>1 ) m->edges += __builtin_popcountll( w ^ packed_word(&tile,r-1,c) );
+			if( col0+c==1 ) bits &= ~(uint64_t)1;	// west of the first column is padding
+			m->edges += __builtin_popcountll( (w ^ packed_word(&tile,r,c-1)) & bits );
+			for(; w; w&=w-1) m->area[ cc_pol(c+__builtin_ctzll(w),r)-1 ]++;
+		}
+}
+
+void write_metrics(char *filename, tile_metrics *m, unsigned int nTiles, unsigned int *mc, unsigned int *dim_cum, unsigned int *final_parent, unsigned int nobjects, uint64_t npixels)
+{
+	/*
+	 *	Reduce the partial metrics of the tiles (the area of their labels goes to the
+	 *	objects through final_parent) and write the landscape metrics of the image as
+	 *	CSV {metric,value}. Areas are in pixels and edges in pixel sides:
+	 *		patch_density			objects per pixel
+	 *		largest_patch_index		% of the image covered by the largest object
+	 *		mean_patch_size			object pixels per object
+	 *		edge_density			object/background sides per pixel
+	 *		effective_mesh_size		sum(area^2) / pixels
+	 *		landscape_division		1 - sum((area/pixels)^2)
+	 *		splitting_index			pixels^2 / sum(area^2)
+	 */
+	unsigned int	iTile, l;
+	uint64_t		sealed=0, edges=0, largest=0;
+	uint64_t		*area = (uint64_t*)calloc(nobjects+1,sizeof(uint64_t));
+	double			sum2=0, A=(double)npixels;
+	FILE			*fid;
+	if (area == NULL) { printf("Error allocating the metrics!\n"); exit(1); }
+	for(iTile=0;iTile<nTiles;iTile++)
+	{
+		for(l=0;l<mc[iTile];l++) area[final_parent[dim_cum[iTile]+l]] += m[iTile].area[l];
+		sealed	+= m[iTile].sealed;
+		edges	+= m[iTile].edges;
+		free(m[iTile].area);
+	}
+	for(l=1;l<=nobjects;l++)
+	{
+		largest	= _max( largest, area[l] );
+		sum2	+= (double)area[l]*area[l];
+	}
+	fid = fopen(filename,"wt");
+	if (fid == NULL) { printf("Error opening file %s!\n",filename); exit(1); }
+	fprintf(fid,"metric,value\n");
+	fprintf(fid,"pixels,%llu\n",(unsigned long long)npixels);
+	fprintf(fid,"sealed_pixels,%llu\n",(unsigned long long)sealed);
+	fprintf(fid,"patches,%u\n",nobjects);
+	fprintf(fid,"patch_density,%.9g\n",nobjects/A);
+	fprintf(fid,"largest_patch_index,%.9g\n",100.0*largest/A);
+	fprintf(fid,"mean_patch_size,%.9g\n",nobjects ? (double)sealed/nobjects : 0.0);
+	fprintf(fid,"edge_density,%.9g\n",edges/A);
+	fprintf(fid,"effective_mesh_size,%.9g\n",sum2/A);
+	fprintf(fid,"landscape_division,%.9g\n",1.0-sum2/(A*A));
+	fprintf(fid,"splitting_index,%.9g\n",sum2>0 ? A*A/sum2 : 0.0);
+	fclose(fid);
+	free(area);
+}
+
+void write_windows(char *filename, tiles_job *J)
+{
+	/*
+	 *	Write the metrics of the moving windows: as CSV {row,col} of the window centre
+	 *	(image coordinates) and its WIN_METRICS values if filename ends with ".csv",
+	 *	otherwise as win_header followed by the grid of windows, row by row, with
+	 *	WIN_METRICS floats per window.
+	 */
+	unsigned int	i, j;
+	size_t			len = strlen(filename), n = (size_t)J->win_rows*J->win_cols*WIN_METRICS;
+	float			*w;
+	FILE			*fid;
+	win_header		h = { WIN_MAGIC, J->win_rows, J->win_cols, WIN_METRICS, J->win_size, J->win_step, {0,0} };
+	fid = fopen(filename,"wb");
+	if (fid == NULL) { printf("Error opening file %s!\n",filename); exit(1); }
+	if( len>=4 && !strcmp(filename+len-4,".csv") )
+	{
+		fprintf(fid,"row,col,sealed,patches,largest_patch_index,edge_density,effective_mesh_size\n");
+		for(i=0;i<J->win_rows;i++)
+			for(j=0;j<J->win_cols;j++)
 			{
-				dependent_id = 1;
-				break;
+				w = J->windows + ((size_t)i*J->win_cols+j)*WIN_METRICS;
+				fprintf(fid,"%ld,%ld,%.6g,%.0f,%.6g,%.6g,%.6g\n", win_center(i,J->win_step,J->NR-2), win_center(j,J->win_step,J->NC-2),
+						w[WIN_SEALED], w[WIN_PATCHES], w[WIN_LPI], w[WIN_ED], w[WIN_MESH] );
 			}
-		}
-		if( dependent_id==1 )
-		{
-			new_PARENT[j*2+0] = j;
-			new_PARENT[j*2+1] = PARENT[k*2+1];
-		}
-		else
-		{
-			new_PARENT[j*2+0] = j;
-			new_PARENT[j*2+1] = j;
-		}
-		//printf("PARENT[%d,1:2]=(%d,%d)\n",j,new_PARENT[j*2+0],new_PARENT[j*2+1]);
 	}
-	// ----(C)----
-	return new_PARENT;
+	else
+	{
+		if( fwrite(&h,sizeof(h),1,fid)!=1 || fwrite(J->windows,sizeof(float),n,fid)!=n )
+		{ printf("Error writing file %s!\n",filename); exit(1); }
+	}
+	fclose(fid);
 }
 
 void second_scan(
 		unsigned int	*lab_mat,
 		unsigned int	nrows,
 		unsigned int	ncols,
+		unsigned int	stride,
 		unsigned int	*PARENT		)
 {
 	unsigned int i,j;
-    for(i=0;i<nrows;i++) for(j=0;j<ncols;j++) cc_pol(j,i) = PARENT[2*cc_pol(j,i)+1];
+    for(i=0;i<nrows;i++) for(j=0;j<ncols;j++) cc_pol(j,i) = PARENT[cc_pol(j,i)];
 }
 
 void print_mat(unsigned char *u,unsigned int nrows,unsigned int ncols, char *Label)
@@ -310,435 +1291,3714 @@ void print_vec( unsigned int *vec, unsigned int numel, unsigned char *Label )
 	printf("\n");
 }
 
-void read_mat(unsigned char *urban, unsigned int nrows, unsigned int ncols, char *filename)
+int alloc_packed(packed_mat *P, unsigned int nrows, unsigned int ncols)
+{
+	// all-background mask of nrows x ncols pixels, -1 if out of memory
+	P->stride	= ((size_t)ncols+63)/64;
+	P->col0		= 0;
+	P->nrows	= nrows;
+	P->ncols	= ncols;
+	P->words	= (uint64_t*)calloc(P->stride*nrows,sizeof(uint64_t));
+	return (P->words == NULL) ? -1 : 0;
+}
+
+void init_packed(packed_mat *P, unsigned int nrows, unsigned int ncols)
+{
+	// as alloc_packed, exiting if out of memory
+	if( alloc_packed(P, nrows, ncols) ) { printf("Error allocating the mask!\n"); exit(1); }
+}
+
+packed_mat packed_view(packed_mat *P, unsigned int row0, unsigned int col0, unsigned int nrows, unsigned int ncols)
+{
+	// nrows x ncols pixels with origin (row0,col0) in P, sharing its words
+	packed_mat V = *P;
+	V.words	= P->words + (size_t)row0*P->stride;
+	V.col0	= P->col0 + col0;
+	V.nrows	= nrows;
+	V.ncols	= ncols;
+	return V;
+}
+
+uint64_t packed_word(packed_mat *P, unsigned int r, unsigned int c)
+{
+	/*
+	 *	Pixels [c,c+64) of row r as one word (pixel c+i is bit i, pixels beyond the
+	 *	last column are background): a view is not aligned to words, so two words
+	 *	are merged when its columns straddle them.
+	 */
+	size_t		b = (size_t)P->col0 + c;
+	uint64_t	*w = P->words + (size_t)r*P->stride + (b>>6);
+	uint64_t	v = w[0] >> (b&63);
+	if( (b&63) && (b>>6)+1<P->stride ) v |= w[1] << (64-(b&63));
+	if( P->ncols-c<64 ) v &= ((uint64_t)1<<(P->ncols-c))-1;
+	return v;
+}
+
+void or_bits(packed_mat *P, unsigned int r, unsigned int c, uint64_t v, unsigned int n)
+{
+	// set the pixels [c,c+n) of row r that are set in the n<=64 low bits of v
+	size_t		b = (size_t)P->col0 + c;
+	uint64_t	*w = P->words + (size_t)r*P->stride + (b>>6);
+	if( n<64 ) v &= ((uint64_t)1<<n)-1;
+	w[0] |= v << (b&63);
+	if( (b&63) && (b&63)+n>64 ) w[1] |= v >> (64-(b&63));
+}
+
+void xor_bits(packed_mat *P, unsigned int r, unsigned int c, uint64_t v, unsigned int n)
+{
+	// flip the pixels [c,c+n) of row r that are set in the n<=64 low bits of v
+	size_t		b = (size_t)P->col0 + c;
+	uint64_t	*w = P->words + (size_t)r*P->stride + (b>>6);
+	if( n<64 ) v &= ((uint64_t)1<<n)-1;
+	w[0] ^= v << (b&63);
+	if( (b&63) && (b&63)+n>64 ) w[1] ^= v >> (64-(b&63));
+}
+
+void pack_bytes(packed_mat *P, unsigned int r, unsigned int c, unsigned char *pixels, unsigned int n)
+{
+	// pack n pixels of one byte each into row r from column c
+	unsigned int i, m;
+	for(i=0;i<n;i+=64)
+	{
+		m = (n-i<64) ? n-i : 64;
+		or_bits( P, r, c+i, row_mask(pixels+i,m), m );
+	}
+}
+
+void pack_bits(packed_mat *P, unsigned int r, unsigned int c, unsigned char *bits, unsigned int n)
+{
+	// pack n pixels already packed one bit each (pixel i is bit i%8 of byte i/8) into row r from column c
+	unsigned int i, k, m;
+	uint64_t v;
+	for(i=0;i<n;i+=64)
+	{
+		m = (n-i<64) ? n-i : 64;
+		for(k=0,v=0;k<(m+7)/8;k++) v |= (uint64_t)bits[i/8+k] << (8*k);
+		or_bits( P, r, c+i, v, m );
+	}
+}
+
+void read_mat(packed_mat *urban, char *filename)
 {
-	unsigned int rr,cc;
 	FILE *fid ;
-	int a;
 	fid= fopen(filename,"rt");
 	if (fid == NULL) { printf("Error opening file!\n"); exit(1); }
-	for(rr=1;rr<nrows-1;rr++) for(cc=1;cc<ncols-1;cc++) { fscanf(fid, "%d",&a);	durban(cc,rr)=(unsigned char)a; }
+	read_rows(fid, urban, 0, urban->nrows);
 	fclose(fid);
 }
 
-void write_mat(unsigned int **lab_mat, unsigned int nr, unsigned int nc, unsigned int ntilesX, unsigned int ntilesY, char *filename)
+void read_rows(FILE *fid, packed_mat *urban, unsigned int row0, unsigned int NR)
 {
-	unsigned int rr,cc,ntX,ntY;
-	FILE *fid ;
-	fid = fopen(filename,"w");
-	if (fid == NULL) { printf("Error opening file %s!\n",filename); exit(1); }
-
-	for(ntY=0;ntY<ntilesY;ntY++)
+	/*
+	 *	Read rows [row0,row0+urban->nrows) of an image of NR rows into urban, going on from
+	 *	the current position of fid: the first/last row and column are padding.
+	 */
+	unsigned int rr,cc,ncols=urban->ncols;
+	int a;
+	unsigned char *pixels = (unsigned char*)malloc(ncols);
+	for(rr=0;rr<urban->nrows;rr++)
 	{
-		for(rr=1;rr<nr;rr++)
-		{
-			for(ntX=0;ntX<ntilesX;ntX++)
-			{
-				for(cc=1;cc<nc;cc++)
-				{
-					if( !(((cc==nc-1) && ((ntilesX*ntY+ntX+1)%ntilesX)==0))	&&	// do not print last column
-						!(((rr==nr-1) && (ntY==ntilesY-1))) 					// do not print last row
-					)
-					{
-						fprintf(fid, "%d ",lab_mat[ntilesX*ntY+ntX][nc*rr+cc]);
-						//printf("%d ",lab_mat[ntilesX*ntY+ntX][nc*rr+cc]);
-					}
-				}
-			}
-			fprintf(fid,"\n");
-			//printf("\n");
-		}
+		memset(urban->words+(size_t)rr*urban->stride,0,urban->stride*sizeof(uint64_t));
+		if( (row0+rr==0) || (row0+rr>=NR-1) ) continue;
+		for(cc=0;cc<ncols-2;cc++) { fscanf(fid, "%d",&a);	pixels[cc]=(unsigned char)a; }
+		pack_bytes(urban, rr, 1, pixels, ncols-2);
 	}
-	fclose(fid);
+	free(pixels);
 }
 
-unsigned int *objects_stitching_nn(
-		unsigned int *lm_nn,		// label matrix of northern tile in the mask
-		unsigned int *lm_cc,		// label matrix of target (=centre) tile in the mask
-		unsigned int nr,		// number of rows
-		unsigned int nc,		// number of columns
-		unsigned int ntile_nn,		// number of nn tile in the grid of tiles
-		unsigned int ntile_cc,		// number of cc tile in the grid of tiles
-		unsigned int *cross_parent	// pointer to the first row in cross_parent
-						)
+unsigned int map_mat(char *filename, mapped_mat *map)
 {
-	unsigned int c;
-	for(c=0;c<nc;c++)
+	/*
+	 *	Map a binary mask in memory. It returns 0 if filename is not a binary mask
+	 *	(i.e. it does not start with BIN_MAGIC), leaving it to read_mat.
+	 *	The header gives rows, cols and bits per pixel:
+	 *		16	one uint16_t per pixel (host byte order), classes only (see pack_classes)
+	 *		 8	one unsigned char per pixel
+	 *		 1	packed pixels, pixel (r,c) is bit c%8 of byte c/8 of row r
+	 *	rows are stored one after the other with no padding other than the bits up to the next byte.
+	 */
+	struct stat	st;
+	bin_header	*h;
+	int			fd;
+	fd = open(filename,O_RDONLY);
+	if (fd < 0) { printf("Error opening file %s!\n",filename); exit(1); }
+	if( fstat(fd,&st) || (size_t)st.st_size<sizeof(bin_header) ) { close(fd); return 0; }
+	map->size = st.st_size;
+	map->base = mmap(NULL,map->size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if (map->base == MAP_FAILED) { printf("Error mapping file %s: %s\n",filename,strerror(errno)); exit(1); }
+	h = (bin_header*)map->base;
+	if( memcmp(h->magic,BIN_MAGIC,4) ) { munmap(map->base,map->size); return 0; }
+	map->nrows	= h->nrows;
+	map->ncols	= h->ncols;
+	map->nbits	= h->nbits;
+	if( map->nbits!=16 && map->nbits!=8 && map->nbits!=1 ) { printf("Error in %s: %d bits per pixel are not supported!\n",filename,map->nbits); exit(1); }
+	if( map->nrows==0 || map->ncols==0 ) { printf("Error in %s: the mask is empty (%u x %u pixels)!\n",filename,map->nrows,map->ncols); exit(1); }
+	map->stride	= (map->nbits==1) ? ((size_t)map->ncols+7)/8 : (size_t)map->ncols*(map->nbits/8);
+	map->data	= (unsigned char*)map->base + sizeof(bin_header);
+	if( map->size < sizeof(bin_header) + map->stride*map->nrows ) { printf("Error in %s: file is truncated!\n",filename); exit(1); }
+	madvise(map->base,map->size,MADV_SEQUENTIAL);
+	return 1;
+}
+
+void unmap_mat(mapped_mat *map)
+{
+	munmap(map->base,map->size);
+}
+
+void pack_map(mapped_mat *map, packed_mat *urban, unsigned int row0, class_mat *K)
+{
+	/*
+	 *	Pack rows [row0,row0+urban->nrows) of the padded image, whose whole rows urban
+	 *	spans, straight from the mapped mask: pixel (r,c) of the padded image is (r-1,c-1)
+	 *	of the mask, anything outside the mask is background. With classes (K not NULL,
+	 *	of the bytes per pixel of the mask) the rows are copied in K and packed from it.
+	 */
+	unsigned int rr, n;
+	unsigned char *row;
+	n = (map->ncols < urban->ncols-1) ? map->ncols : urban->ncols-1;
+	for(rr=0;rr<urban->nrows;rr++)
 	{
-		if (lm_nn[nc*(nr-1)+c]!=0)
+		memset(urban->words+(size_t)rr*urban->stride,0,urban->stride*sizeof(uint64_t));
+		if( (row0+rr==0) || (row0+rr>map->nrows) ) continue;
+		row = map->data + (size_t)(row0+rr-1)*map->stride;
+		if( K!=NULL )
 		{
-			*cross_parent++	= ntile_cc;				// parent tile number
-			*cross_parent++	= lm_cc[c];				// parent ID of parent tile number
-			*cross_parent++	= ntile_nn;				// root tile number
-			*cross_parent++	= lm_nn[nc*(nr-1)+c];	// root ID of root tile number
+			memcpy(class_ptr(K,row0+rr,1), row, (size_t)n*K->nbytes);
+			pack_classes(urban, rr, K, row0+rr);
 		}
+		else if( map->nbits==8 ) pack_bytes(urban, rr, 1, row, n);
+		else pack_bits(urban, rr, 1, row, n);
 	}
-	return cross_parent;
 }
 
-unsigned int *objects_stitching_ww(
-		unsigned int *lm_ww,		// label matrix of western tile in the mask
-		unsigned int *lm_cc,		// label matrix of target (=centre) tile in the mask
-		unsigned int nr,		// number of rows
-		unsigned int nc,		// number of columns
-		unsigned int ntile_ww,		// number of ww tile in the grid of tiles
-		unsigned int ntile_cc,		// number of cc tile in the grid of tiles
-		unsigned int *cross_parent	// pointer to the first row in cross_parent
-						)
+void init_classes(class_mat *K, unsigned int nrows, unsigned int ncols, unsigned int nbytes)
 {
-	unsigned int r;
-	for(r=0;r<nr;r++)
+	// classes of nrows x ncols pixels, all background
+	K->stride	= ncols;
+	K->nbytes	= nbytes;
+	K->data		= calloc((size_t)nrows*ncols,nbytes);
+	if (K->data == NULL) { printf("Error allocating the classes!\n"); exit(1); }
+}
+
+void pack_classes(packed_mat *P, unsigned int r, class_mat *K, unsigned int kr)
+{
+	// set the pixels of row r of P whose class in row kr of K is not background (Vb)
+	unsigned int c, i, m;
+	uint64_t v;
+	for(c=0;c<P->ncols;c+=64)
 	{
-		if (lm_ww[nc*(r+1)-1]!=0)
-		{
-			*cross_parent++	= ntile_cc;		// parent tile number
-			*cross_parent++	= lm_cc[nc*r];		// parent ID of parent tile number
-			*cross_parent++	= ntile_ww;		// root tile number
-			*cross_parent++	= lm_ww[nc*(r+1)-1];	// root ID of root tile number
-		}
+		m = (P->ncols-c<64) ? P->ncols-c : 64;
+		v = 0;
+		if( K->nbytes==1 )	for(i=0;i<m;i++) v |= (uint64_t)(((uint8_t*)class_ptr(K,kr,c))[i]!=Vb) << i;
+		else				for(i=0;i<m;i++) v |= (uint64_t)(((uint16_t*)class_ptr(K,kr,c))[i]!=Vb) << i;
+		or_bits(P, r, c, v, m);
 	}
-	return cross_parent;
 }
 
-unsigned int *objects_stitching_cc(
-		unsigned int *lm_cc,			// label matrix of target (=centre) tile in the mask
-		unsigned int nr,				// number of rows
-		unsigned int nc,				// number of columns
-		unsigned int ntile_cc,			// number of cc tile in the grid of tiles
-		unsigned int *cross_parent,		// pointer to the first row in cross_parent
-		unsigned int *cross_parent_ii,	// pointer to the first element before stitching by {nn,ww}
-		unsigned int first_empty,		// the first empty row in cross_parent [SCALAR]
-		unsigned int *PARENT,			// the PARENT vector of target tile within tiles-mask
-		unsigned int maxcount			// number of labels in target tile stored in PARENT
-						)
+void read_classes(packed_mat *urban, class_mat *K, char *filename)
 {
-	unsigned int i,j;
-	unsigned char found=0;
-	for(i=1;i<=maxcount;i++) // start from 1, because 0 is background
+	// as read_mat, for 16-bit classes
+	unsigned int rr,cc;
+	int a;
+	FILE *fid ;
+	fid= fopen(filename,"rt");
+	if (fid == NULL) { printf("Error opening file!\n"); exit(1); }
+	memset(urban->words,0,urban->stride*urban->nrows*sizeof(uint64_t));
+	for(rr=1;rr<urban->nrows-1;rr++)
 	{
-		// The current ntile_cc is on the left-hand side? If yes then the equivalence with (tile) + (intra-tile ID) is not a ROOT equivalence, because cross_parent only stores non-ROOT equivalences!
-		found = 0;
-		for(j=0;j<first_empty;j++) if( (cross_parent_ii[j*cross_cols+0]==ntile_cc) && (cross_parent_ii[j*cross_cols+1]==PARENT[i*2+1]) ) {found = 1; break;}
-
-		// If the current tile was not found in cross_parent then it gives a new ROOT equivalence.
-		if (found==0) // then record current label as ROOT label! (i.e. elements {1,2} are equal to elements {3,4} of cross_parent
+		for(cc=1;cc<urban->ncols-1;cc++)
 		{
-			*cross_parent++	= ntile_cc;			// parent tile number
-			*cross_parent++	= PARENT[i*2+0];	// parent ID of parent tile number
-			*cross_parent++	= ntile_cc;			// root tile number
-			*cross_parent++	= PARENT[i*2+1];	// root ID of root tile number
+			fscanf(fid, "%d",&a);
+			if( a<0 || a>UINT16_MAX ) { printf("Error in %s: class %d is not uint16!\n",filename,a); exit(1); }
+			((uint16_t*)class_ptr(K,rr,cc))[0] = (uint16_t)a;
 		}
+		pack_classes(urban, rr, K, rr);
 	}
-	return cross_parent;
+	fclose(fid);
 }
-unsigned int *record_cross_equivalence(
-		unsigned int **lm,
-		unsigned int *cross_parent,
-		unsigned int nr,
-		unsigned int nc,
+
+uint64_t tiff_get(tiff_mat *T, const unsigned char *p, unsigned int nbytes)
+{
+	// unsigned integer of nbytes in the byte order of the file
+	uint64_t v=0;
+	unsigned int i;
+	for(i=0;i<nbytes;i++) v |= (uint64_t)p[ T->big_endian ? nbytes-1-i : i ] << (8*i);
+	return v;
+}
+
+void tiff_put(unsigned char *p, uint64_t v, unsigned int nbytes)
+{
+	// unsigned integer of nbytes in host byte order
+	uint8_t v8=v; uint16_t v16=v; uint32_t v32=v;
+	switch(nbytes)
+	{
+		case 1: memcpy(p,&v8,1);	break;
+		case 2: memcpy(p,&v16,2);	break;
+		case 4: memcpy(p,&v32,4);	break;
+		case 8: memcpy(p,&v,8);		break;
+	}
+}
+
+unsigned int tiff_type_size(unsigned int type)
+{
+	switch(type)
+	{
+		case 1: case 2: case 6: case 7:	return 1;	// BYTE, ASCII, SBYTE, UNDEFINED
+		case 3: case 8:					return 2;	// SHORT, SSHORT
+		case 4: case 9: case 11:		return 4;	// LONG, SLONG, FLOAT
+		case 5: case 10: case 12:
+		case 16: case 17: case 18:		return 8;	// RATIONAL, SRATIONAL, DOUBLE, LONG8, SLONG8, IFD8
+		default:						return 0;
+	}
+}
+
+unsigned int map_tiff(char *filename, tiff_mat *T)
+{
+	/*
+	 *	Map a TIFF (or BigTIFF) in memory and parse its first IFD. It returns 0 if
+	 *	filename is not a TIFF. Only single-band 8-bit images are supported, stored
+	 *	either by tiles or by strips, uncompressed, PackBits or Deflate (with zlib),
+	 *	with or without horizontal predictor. Strips are handled as tiles as wide as
+	 *	the image, so that every block of pixels can be decoded on its own (see tiff_cut_tile).
+	 *	The georeferencing tags are kept (in host byte order) for the output labels.
+	 */
+	struct stat		st;
+	int				fd;
+	unsigned char	*p, *e, *v;
+	uint64_t		n, i, k, count, ifd;
+	unsigned int	tag, type, esize, bits=8, spp=1, planar=1, sformat=1, tiled=0;
+	uint64_t		*offsets=NULL, *bytecounts=NULL;
+	unsigned int	noffsets=0, nbytecounts=0;
+
+	memset(T,0,sizeof(tiff_mat));
+	fd = open(filename,O_RDONLY);
+	if (fd < 0) { printf("Error opening file %s!\n",filename); exit(1); }
+	if( fstat(fd,&st) || st.st_size<16 ) { close(fd); return 0; }
+	T->size = st.st_size;
+	T->base = mmap(NULL,T->size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if (T->base == MAP_FAILED) { printf("Error mapping file %s: %s\n",filename,strerror(errno)); exit(1); }
+	p = (unsigned char*)T->base;
+	if		( p[0]=='I' && p[1]=='I' ) T->big_endian = 0;
+	else if	( p[0]=='M' && p[1]=='M' ) T->big_endian = 1;
+	else { munmap(T->base,T->size); return 0; }
+	switch( tiff_get(T,p+2,2) )
+	{
+		case 42: T->bigtiff = 0; ifd = tiff_get(T,p+4,4); break;
+		case 43: T->bigtiff = 1; ifd = tiff_get(T,p+8,8); break;
+		default: munmap(T->base,T->size); return 0;
+	}
+	esize	= T->bigtiff ? 20 : 12;
+	if( ifd+8 > T->size ) { printf("Error in %s: bad IFD offset!\n",filename); exit(1); }
+	n		= T->bigtiff ? tiff_get(T,p+ifd,8) : tiff_get(T,p+ifd,2);
+	e		= p + ifd + (T->bigtiff ? 8 : 2);
+	if( ifd + (T->bigtiff ? 8 : 2) + n*esize > T->size ) { printf("Error in %s: truncated IFD!\n",filename); exit(1); }
+	for(i=0;i<n;i++,e+=esize)
+	{
+		tag		= tiff_get(T,e+0,2);
+		type	= tiff_get(T,e+2,2);
+		count	= T->bigtiff ? tiff_get(T,e+4,8) : tiff_get(T,e+4,4);
+		// values fit in the entry or are at the offset given by the entry
+		v		= e + (T->bigtiff ? 12 : 8);
+		if( count*tiff_type_size(type) > (T->bigtiff ? 8 : 4) )
+		{
+			v = p + (T->bigtiff ? tiff_get(T,v,8) : tiff_get(T,v,4));
+			if( v+count*tiff_type_size(type) > p+T->size ) { printf("Error in %s: tag %d out of file!\n",filename,tag); exit(1); }
+		}
+		switch(tag)
+		{
+			case 256:	T->ncols		= tiff_get(T,v,tiff_type_size(type));	break;
+			case 257:	T->nrows		= tiff_get(T,v,tiff_type_size(type));	break;
+			case 258:	bits			= tiff_get(T,v,tiff_type_size(type));	break;
+			case 259:	T->compression	= tiff_get(T,v,tiff_type_size(type));	break;
+			case 277:	spp				= tiff_get(T,v,tiff_type_size(type));	break;
+			case 278:	T->block_h		= tiff_get(T,v,tiff_type_size(type));	break;	// RowsPerStrip
+			case 284:	planar			= tiff_get(T,v,tiff_type_size(type));	break;
+			case 317:	T->predictor	= tiff_get(T,v,tiff_type_size(type));	break;
+			case 322:	T->block_w		= tiff_get(T,v,tiff_type_size(type));	tiled = 1;	break;	// TileWidth
+			case 323:	T->block_h		= tiff_get(T,v,tiff_type_size(type));	tiled = 1;	break;	// TileLength
+			case 339:	sformat			= tiff_get(T,v,tiff_type_size(type));	break;
+			case 273: case 324:	// StripOffsets, TileOffsets
+			case 279: case 325:	// StripByteCounts, TileByteCounts
+				if( (tag==273 || tag==324) ) { offsets = (uint64_t*)malloc(count*sizeof(uint64_t)); noffsets = count; }
+				else { bytecounts = (uint64_t*)malloc(count*sizeof(uint64_t)); nbytecounts = count; }
+				for(k=0;k<count;k++)
+					((tag==273 || tag==324) ? offsets : bytecounts)[k] = tiff_get(T,v+k*tiff_type_size(type),tiff_type_size(type));
+				break;
+			case 33550: case 33922: case 34264:	// ModelPixelScale, ModelTiepoint, ModelTransformation
+			case 34735: case 34736: case 34737:	// GeoKeyDirectory, GeoDoubleParams, GeoAsciiParams
+				if( T->ngeo<TIFF_MAX_GEO )
+				{
+					tiff_tag *g	= &T->geo[T->ngeo++];
+					g->tag		= tag;
+					g->type		= type;
+					g->count	= count;
+					g->value	= (unsigned char*)malloc(count*tiff_type_size(type));
+					for(k=0;k<count;k++)
+					{
+						uint64_t	x = tiff_get(T,v+k*tiff_type_size(type),tiff_type_size(type));
+						tiff_put(g->value+k*tiff_type_size(type),x,tiff_type_size(type));
+					}
+				}
+				break;
+		}
+	}
+	if( bits!=8 || spp!=1 || (planar!=1 && spp>1) || sformat!=1 )
+	{ printf("Error in %s: only single-band 8-bit unsigned TIFFs are supported!\n",filename); exit(1); }
+	if( T->compression!=TIFF_NONE && T->compression!=TIFF_PACKBITS && T->compression!=TIFF_DEFLATE && T->compression!=TIFF_ADOBE_DEFLATE )
+	{ printf("Error in %s: compression %d is not supported!\n",filename,T->compression); exit(1); }
+#ifndef WITH_ZLIB
+	if( T->compression==TIFF_DEFLATE || T->compression==TIFF_ADOBE_DEFLATE )
+	{ printf("Error in %s: Deflate compression needs a build with -DWITH_ZLIB -lz!\n",filename); exit(1); }
+#endif
+	if( T->predictor>1 && T->predictor!=2 ) { printf("Error in %s: predictor %d is not supported!\n",filename,T->predictor); exit(1); }
+	if( T->nrows==0 || T->ncols==0 ) { printf("Error in %s: the image is empty (%u x %u pixels)!\n",filename,T->nrows,T->ncols); exit(1); }
+	if( tiled && (T->block_w==0 || T->block_h==0) ) { printf("Error in %s: tiles of %u x %u pixels!\n",filename,T->block_w,T->block_h); exit(1); }
+	// strips are tiles as wide as the image
+	if( T->block_w==0 ) T->block_w = T->ncols;
+	if( T->block_h==0 || T->block_h>T->nrows ) T->block_h = T->nrows;
+	T->blocks_across	= (T->ncols + T->block_w-1) / T->block_w;
+	T->nblocks			= T->blocks_across * ((T->nrows + T->block_h-1) / T->block_h);
+	if( offsets==NULL || bytecounts==NULL || noffsets<T->nblocks || nbytecounts<T->nblocks )
+	{ printf("Error in %s: missing offsets of strips/tiles!\n",filename); exit(1); }
+	for(k=0;k<T->nblocks;k++)
+		if( offsets[k]+bytecounts[k] > T->size ) { printf("Error in %s: strip/tile %d out of file!\n",filename,(unsigned int)k); exit(1); }
+	T->offsets		= offsets;
+	T->bytecounts	= bytecounts;
+	return 1;
+}
+
+void open_tiff_cache(tiff_mat *T, unsigned int tiledimY)
+{
+	/*
+	 *	Decoded strips/tiles are kept in a direct-mapped cache large enough for two rows
+	 *	of labeling tiles, since every block is read by the (overlapping) labeling tiles
+	 *	around it.
+	 */
+	unsigned int k;
+	T->nslots	= _min( T->nblocks, 2*T->blocks_across*((tiledimY+T->block_h-1)/T->block_h+1) );
+	T->cache	= (tiff_slot*)calloc(T->nslots,sizeof(tiff_slot));
+	for(k=0;k<T->nslots;k++)
+	{
+		pthread_mutex_init(&T->cache[k].lock,NULL);
+		T->cache[k].block	= -1;
+		T->cache[k].buf		= (unsigned char*)malloc((size_t)T->block_w*T->block_h);
+	}
+}
+
+void unmap_tiff(tiff_mat *T)
+{
+	unsigned int k;
+	for(k=0;k<T->nslots;k++)
+	{
+		pthread_mutex_destroy(&T->cache[k].lock);
+		free(T->cache[k].buf);
+	}
+	for(k=0;k<T->ngeo;k++) free(T->geo[k].value);
+	free(T->cache);
+	free(T->offsets);
+	free(T->bytecounts);
+	munmap(T->base,T->size);
+}
+
+void tiff_decode_block(tiff_mat *T, unsigned int k, unsigned char *buf)
+{
+	// decode the k-th strip/tile in buf (block_w x block_h pixels)
+	unsigned char	*in		= (unsigned char*)T->base + T->offsets[k];
+	unsigned char	*end	= in + T->bytecounts[k];
+	size_t			numel	= (size_t)T->block_w*T->block_h, o=0;
+	unsigned int	r, c;
+	int				n;
+	memset(buf,0,numel);
+	switch(T->compression)
+	{
+		case TIFF_NONE:
+			memcpy(buf,in,_min(numel,T->bytecounts[k]));
+			break;
+		case TIFF_PACKBITS:
+			while( in<end && o<numel )
+			{
+				n = (signed char)*in++;
+				if( n>=0 )			{ n = _min( (size_t)n+1, _min( (size_t)(end-in), numel-o ) ); memcpy(buf+o,in,n); in+=n; o+=n; }
+				else if( n!=-128 && in<end )	{ n = _min( (size_t)(1-n), numel-o ); memset(buf+o,*in++,n); o+=n; }
+			}
+			break;
+#ifdef WITH_ZLIB
+		case TIFF_DEFLATE:
+		case TIFF_ADOBE_DEFLATE:
+		{
+			uLongf size = numel;
+			int err = uncompress(buf,&size,in,T->bytecounts[k]);
+			if( err!=Z_OK && err!=Z_BUF_ERROR ) { printf("Error decoding TIFF block %d!\n",k); exit(1); }
+			break;
+		}
+#endif
+	}
+	if( T->predictor==2 )
+		for(r=0;r<T->block_h;r++) for(c=1;c<T->block_w;c++) buf[r*T->block_w+c] += buf[r*T->block_w+c-1];
+}
+
+void tiff_pack(tiff_mat *T, packed_mat *urban, unsigned int row0, class_mat *K)
+{
+	/*
+	 *	As pack_map, for a TIFF: only the strips/tiles intersecting the rows are
+	 *	decoded (or found in the cache).
+	 */
+	unsigned int	r0, r1, c1, by, bx, r, ra, rb, cb, k;
+	tiff_slot		*slot;
+	memset(urban->words,0,urban->stride*urban->nrows*sizeof(uint64_t));
+	// pixels [r0,r1) x [0,c1) of the image fall within the rows (padded (r,c) is (r-1,c-1) of the image)
+	r0 = (row0==0) ? 0 : row0-1;		r1 = _min( row0+urban->nrows-1, T->nrows );
+	c1 = _min( urban->ncols-1, T->ncols );
+	if( r0>=r1 ) return;
+	for(by=r0/T->block_h; by*T->block_h<r1; by++)
+		for(bx=0; bx*T->block_w<c1; bx++)
+		{
+			k	= by*T->blocks_across + bx;
+			ra	= _max( r0, by*T->block_h );	rb	= _min( r1, (by+1)*T->block_h );
+			cb	= _min( c1, (bx+1)*T->block_w );
+			slot = &T->cache[k % T->nslots];
+			pthread_mutex_lock(&slot->lock);
+			if( slot->block!=k ) { tiff_decode_block(T,k,slot->buf); slot->block = k; }
+			for(r=ra;r<rb;r++)
+				if( K!=NULL )	memcpy(	class_ptr(K,r+1,bx*T->block_w+1),
+										slot->buf + (size_t)(r-by*T->block_h)*T->block_w, cb-bx*T->block_w );
+				else			pack_bytes(	urban, r+1-row0, bx*T->block_w+1,
+											slot->buf + (size_t)(r-by*T->block_h)*T->block_w, cb-bx*T->block_w );
+			pthread_mutex_unlock(&slot->lock);
+		}
+	if( K!=NULL ) for(r=r0;r<r1;r++) pack_classes(urban, r+1-row0, K, r+1);
+}
+
+
+void open_labels(label_writer *W, char *filename, unsigned int nrows, unsigned int ncols, unsigned int nobjects, unsigned int rows_per_chunk, tiff_mat *geo)
+{
+	/*
+	 *	Open the output labels in the format set by out_format:
+	 *		OUT_TEXT	one "%d " per pixel and one line per row, as write_mat
+	 *		OUT_BIN		lab_header followed by the rows of labels
+	 *		OUT_ZBIN	lab_header, a table of {offset,size} (two uint64) per chunk and the
+	 *					chunks, each one a zlib stream of rows_per_chunk rows of labels
+	 *		OUT_TIFF	TIFF (BigTIFF beyond 4 GB) with one strip per chunk of rows,
+	 *		OUT_ZTIFF	uncompressed or Deflate, keeping the georeferencing tags of geo
+	 *					(if not NULL); the IFD is written by close_labels
+	 *	Labels are stored as uint16 when the objects fit, as uint32 otherwise (host byte order).
+	 */
+	lab_header	h;
+	uint64_t	raw;
+	W->format			= out_format;
+	W->nrows			= nrows;
+	W->ncols			= ncols;
+	W->nbits			= (nobjects<=0xFFFF) ? 16 : 32;
+	W->rows_per_chunk	= rows_per_chunk;
+	W->nchunks			= (W->format!=OUT_BIN) ? (nrows+rows_per_chunk-1)/rows_per_chunk : 0;
+	W->compressed		= (W->format==OUT_ZBIN || W->format==OUT_ZTIFF);
+	W->chunk_table		= NULL;
+	W->geo				= geo;
+	if( W->format==OUT_TEXT )
+	{
+		W->fid = fopen(filename,"w");
+		if (W->fid == NULL) { printf("Error opening file %s!\n",filename); exit(1); }
+		return;
+	}
+#ifndef WITH_ZLIB
+	if( W->compressed ) { printf("Error: compressed output needs a build with -DWITH_ZLIB -lz!\n"); exit(1); }
+#endif
+	W->fd = open(filename,O_WRONLY|O_CREAT|O_TRUNC,0644);
+	if (W->fd < 0) { printf("Error opening file %s!\n",filename); exit(1); }
+	raw = (uint64_t)nrows*ncols*W->nbits/8;
+	switch( W->format )
+	{
+		case OUT_BIN:
+		case OUT_ZBIN:
+			memset(&h,0,sizeof(lab_header));
+			memcpy(h.magic,LAB_MAGIC,4);
+			h.nrows				= nrows;
+			h.ncols				= ncols;
+			h.nbits				= W->nbits;
+			h.nobjects			= nobjects;
+			h.nchunks			= (W->format==OUT_ZBIN) ? W->nchunks : 0;
+			h.rows_per_chunk	= rows_per_chunk;
+			if( pwrite(W->fd,&h,sizeof(lab_header),0)!=sizeof(lab_header) ) { printf("Error writing file %s!\n",filename); exit(1); }
+			W->data_start		= sizeof(lab_header) + h.nchunks*2*sizeof(uint64_t);
+			break;
+		case OUT_TIFF:
+		case OUT_ZTIFF:
+			W->bigtiff			= (raw > 0xF0000000);
+			W->data_start		= W->bigtiff ? 16 : 8;	// header
+			break;
+	}
+	// compressed chunks are appended, while raw rows have their own place
+	W->next_offset = W->compressed ? W->data_start : W->data_start + raw;
+	if( W->format!=OUT_BIN ) W->chunk_table = (uint64_t*)calloc(2*W->nchunks,sizeof(uint64_t));
+	pthread_mutex_init(&W->lock,NULL);
+}
+
+void write_labels(label_writer *W, unsigned int row0, unsigned int nrows, unsigned int *labels)
+{
+	/*
+	 *	Write rows [row0,row0+nrows) of labels. In binary formats rows go at their own
+	 *	offset, so that concurrent calls are safe provided that, but for OUT_BIN, row0 is
+	 *	the first row of a chunk and nrows its number of rows. OUT_TEXT must be written in order.
+	 */
+	size_t i, numel = (size_t)nrows*W->ncols, nbytes = numel*W->nbits/8;
+	unsigned char *buf;
+	off_t offset = 0;
+	if( W->format==OUT_TEXT )
+	{
+		for(i=0;i<numel;i++)
+		{
+			fprintf(W->fid, "%d ",labels[i]);
+			if( (i+1)%W->ncols==0 ) fprintf(W->fid,"\n");
+		}
+		return;
+	}
+	if( W->nbits==32 ) buf = (unsigned char*)labels;
+	else
+	{
+		buf = (unsigned char*)malloc(nbytes);
+		for(i=0;i<numel;i++) ((uint16_t*)buf)[i] = (uint16_t)labels[i];
+	}
+	if( !W->compressed )
+	{
+		offset = W->data_start + (off_t)row0*W->ncols*W->nbits/8;
+		if( pwrite(W->fd,buf,nbytes,offset)!=nbytes ) { printf("Error writing labels!\n"); exit(1); }
+	}
+#ifdef WITH_ZLIB
+	else
+	{
+		uLongf	zsize	= compressBound(nbytes);
+		Bytef	*zbuf	= (Bytef*)malloc(zsize);
+		if( compress2(zbuf,&zsize,buf,nbytes,Z_DEFAULT_COMPRESSION)!=Z_OK ) { printf("Error compressing labels!\n"); exit(1); }
+		// reserve the place of the chunk at the end of the file
+		pthread_mutex_lock(&W->lock);
+		offset			= W->next_offset;
+		W->next_offset += zsize;
+		pthread_mutex_unlock(&W->lock);
+		if( pwrite(W->fd,zbuf,zsize,offset)!=zsize ) { printf("Error writing labels!\n"); exit(1); }
+		nbytes = zsize;
+		free(zbuf);
+	}
+#endif
+	if( W->chunk_table )
+	{
+		W->chunk_table[2*(row0/W->rows_per_chunk)+0] = offset;
+		W->chunk_table[2*(row0/W->rows_per_chunk)+1] = nbytes;
+	}
+	if( buf!=(unsigned char*)labels ) free(buf);
+}
+
+void close_labels(label_writer *W)
+{
+	if( W->format==OUT_TEXT )
+	{
+		fclose(W->fid);
+		return;
+	}
+	if( W->format==OUT_ZBIN )
+		if( pwrite(W->fd,W->chunk_table,W->nchunks*2*sizeof(uint64_t),sizeof(lab_header))!=W->nchunks*2*sizeof(uint64_t) ) { printf("Error writing labels!\n"); exit(1); }
+	if( W->format==OUT_TIFF || W->format==OUT_ZTIFF ) write_tiff_ifd(W);
+	free(W->chunk_table);
+	pthread_mutex_destroy(&W->lock);
+	close(W->fd);
+}
+
+void write_tiff_ifd(label_writer *W)
+{
+	/*
+	 *	The IFD goes at the end of the file, followed by the values which do not fit in
+	 *	its entries; the header pointing to it is written last. Everything is in host
+	 *	byte order, which the header declares.
+	 */
+	unsigned int	big		= W->bigtiff;
+	unsigned int	esize	= big ? 20 : 12;	// size of an entry
+	unsigned int	vsize	= big ?  8 :  4;	// size of the value/offset field of an entry
+	unsigned int	osize	= big ?  8 :  4;	// size of strip offsets
+	unsigned int	n=0, k, bytes;
+	uint16_t		one		= 1;
+	unsigned char	scalars[16*8], *strip_offsets, *strip_sizes, *ifd, *e;
+	tiff_tag		tags[16+TIFF_MAX_GEO];
+	uint64_t		ifd_offset, ifd_size, extra;
+
+	strip_offsets	= (unsigned char*)malloc((size_t)W->nchunks*osize);
+	strip_sizes		= (unsigned char*)malloc((size_t)W->nchunks*osize);
+	for(k=0;k<W->nchunks;k++)
+	{
+		tiff_put(strip_offsets+k*osize,W->chunk_table[2*k+0],osize);
+		tiff_put(strip_sizes  +k*osize,W->chunk_table[2*k+1],osize);
+	}
+	// (tags must be sorted)
+#define ADD_TAG(t,ty,cnt,val)	{ tags[n].tag=t; tags[n].type=ty; tags[n].count=cnt; tags[n].value=val; n++; }
+#define ADD_SCALAR(t,ty,x)		{ tiff_put(scalars+8*n,x,tiff_type_size(ty)); ADD_TAG(t,ty,1,scalars+8*n); }
+	ADD_SCALAR(256,	4,	W->ncols);										// ImageWidth
+	ADD_SCALAR(257,	4,	W->nrows);										// ImageLength
+	ADD_SCALAR(258,	3,	W->nbits);										// BitsPerSample
+	ADD_SCALAR(259,	3,	W->compressed ? TIFF_ADOBE_DEFLATE : TIFF_NONE);	// Compression
+	ADD_SCALAR(262,	3,	1);												// Photometric: BlackIsZero
+	ADD_TAG(273,	big ? 16 : 4,	W->nchunks,	strip_offsets);				// StripOffsets
+	ADD_SCALAR(277,	3,	1);												// SamplesPerPixel
+	ADD_SCALAR(278,	4,	W->rows_per_chunk);								// RowsPerStrip
+	ADD_TAG(279,	big ? 16 : 4,	W->nchunks,	strip_sizes);				// StripByteCounts
+	ADD_SCALAR(284,	3,	1);												// PlanarConfiguration: contiguous
+	ADD_SCALAR(339,	3,	1);												// SampleFormat: unsigned
+	if( W->geo ) for(k=0;k<W->geo->ngeo;k++) ADD_TAG(W->geo->geo[k].tag,W->geo->geo[k].type,W->geo->geo[k].count,W->geo->geo[k].value);
+#undef ADD_SCALAR
+#undef ADD_TAG
+
+	ifd_offset	= (W->next_offset+1) & ~(uint64_t)1;	// word boundary
+	ifd_size	= (big ? 8 : 2) + n*esize + (big ? 8 : 4);
+	extra		= ifd_size;
+	for(k=0;k<n;k++) if( tags[k].count*tiff_type_size(tags[k].type) > vsize ) extra += (tags[k].count*tiff_type_size(tags[k].type)+1) & ~(uint64_t)1;
+	ifd			= (unsigned char*)calloc(extra,1);
+	tiff_put(ifd,n,big ? 8 : 2);
+	extra		= ifd_size;
+	for(k=0;k<n;k++)
+	{
+		e		= ifd + (big ? 8 : 2) + k*esize;
+		bytes	= tags[k].count*tiff_type_size(tags[k].type);
+		tiff_put(e+0,tags[k].tag,2);
+		tiff_put(e+2,tags[k].type,2);
+		tiff_put(e+4,tags[k].count,big ? 8 : 4);
+		if( bytes<=vsize ) memcpy(e+4+(big ? 8 : 4),tags[k].value,bytes);
+		else
+		{
+			tiff_put(e+4+(big ? 8 : 4),ifd_offset+extra,vsize);
+			memcpy(ifd+extra,tags[k].value,bytes);
+			extra += (bytes+1) & ~1;
+		}
+	}
+	// (next IFD offset is 0)
+	if( pwrite(W->fd,ifd,extra,ifd_offset)!=extra ) { printf("Error writing labels!\n"); exit(1); }
+
+	// header
+	memset(scalars,0,16);
+	memcpy(scalars, (*(unsigned char*)&one==1) ? "II" : "MM", 2);
+	tiff_put(scalars+2,big ? 43 : 42,2);
+	if( big ) { tiff_put(scalars+4,8,2); tiff_put(scalars+8,ifd_offset,8); }
+	else tiff_put(scalars+4,ifd_offset,4);
+	if( pwrite(W->fd,scalars,W->data_start,0)!=W->data_start ) { printf("Error writing labels!\n"); exit(1); }
+
+	free(ifd);
+	free(strip_offsets);
+	free(strip_sizes);
+}
+
+unsigned int tile_row_labels(tiles_job *J, unsigned int ntY, unsigned int *rows)
+{
+	/*
+	 *	Gather the output rows owned by the ntY-th row of tiles, skipping the overlapping
+	 *	first column/row of tiles and what is beyond the image as write_mat does. It
+	 *	returns the number of rows.
+	 */
+	unsigned int rr,cc,ntX,k=0,nr=0;
+	for(rr=1;rr<J->tiledimY;rr++)
+	{
+		if( ntY*(J->tiledimY-1)+rr > J->NR-2 ) break;						// beyond the last row
+		for(ntX=0;ntX<J->ntilesX;ntX++)
+			for(cc=1;cc<J->tiledimX;cc++)
+			{
+				if( ntX*(J->tiledimX-1)+cc > J->NC-2 ) break;				// beyond the last column
+				rows[k++] = J->lab_mat[ntY*J->ntilesX+ntX][J->stride*rr+cc];
+			}
+		nr++;
+	}
+	return nr;
+}
+
+void write_mat(unsigned int **lab_mat, unsigned int nr, unsigned int nc, unsigned int stride, unsigned int ntilesX, unsigned int ntilesY, unsigned int NR, unsigned int NC, char *filename)
+{
+	unsigned int rr,cc,ntX,ntY;
+	FILE *fid ;
+	fid = fopen(filename,"w");
+	if (fid == NULL) { printf("Error opening file %s!\n",filename); exit(1); }
+
+	for(ntY=0;ntY<ntilesY;ntY++)
+	{
+		for(rr=1;rr<nr;rr++)
+		{
+			if( ntY*(nr-1)+rr > NR-2 ) break;								// do not print beyond the last row
+			for(ntX=0;ntX<ntilesX;ntX++)
+			{
+				for(cc=1;cc<nc;cc++)
+				{
+					if( ntX*(nc-1)+cc > NC-2 ) break;						// do not print beyond the last column
+					fprintf(fid, "%d ",lab_mat[ntilesX*ntY+ntX][stride*rr+cc]);
+					//printf("%d ",lab_mat[ntilesX*ntY+ntX][stride*rr+cc]);
+				}
+			}
+			fprintf(fid,"\n");
+			//printf("\n");
+		}
+	}
+	fclose(fid);
+}
+
+/*
+ *	The inter-tile equivalences are solved by a global union-find forest stored
+ *	in final_parent and indexed by the key of a (tile,label) pair:
+ *		key = dim_cum[tile] + label - 1
+ *	Keys grow with the tile number and, within a tile, with the label, and every
+ *	union links towards the smaller key (see record_equivalence). Hence the ROOT
+ *	of every object is its (tile,label) pair met first in raster order of tiles.
+ */
+void objects_stitching_nn(
+		unsigned int *lm_nn,		// label matrix of northern tile in the mask
+		unsigned int *lm_cc,		// label matrix of target (=centre) tile in the mask
+		unsigned int nr,		// number of rows
+		unsigned int nc,		// number of columns
+		unsigned int stride,	// row pitch of the label raster
+		unsigned int dim_nn,		// first key of nn tile in final_parent
+		unsigned int dim_cc,		// first key of cc tile in final_parent
+		unsigned int *final_parent,	// union-find forest of (tile,label) keys
+		const label_config *cfg		// connectivity and partition of the tiles
+						)
+{
+	unsigned int c, d;
+	if( cfg->partition )
+	{	// -P: the first row of cc is its halo, row 1 faces the last row of nn (and its diagonals)
+		for(c=1;c<nc;c++)
+			if( lm_cc[stride+c]!=0 )
+				for(d=c-(cfg->connectivity==8 && c>1); d<=c+(cfg->connectivity==8 && c+1<nc); d++)
+					if( lm_nn[stride*(nr-1)+d]!=0 )
+						record_equivalence( dim_cc+lm_cc[stride+c]-1, dim_nn+lm_nn[stride*(nr-1)+d]-1, final_parent );
+		return;
+	}
+	for(c=0;c<nc;c++)
+	{
+		if (lm_nn[stride*(nr-1)+c]!=0)
+			record_equivalence( dim_cc+lm_cc[c]-1, dim_nn+lm_nn[stride*(nr-1)+c]-1, final_parent );
+	}
+}
+
+void objects_stitching_ww(
+		unsigned int *lm_ww,		// label matrix of western tile in the mask
+		unsigned int *lm_cc,		// label matrix of target (=centre) tile in the mask
+		unsigned int nr,		// number of rows
+		unsigned int nc,		// number of columns
+		unsigned int stride,	// row pitch of the label raster
+		unsigned int dim_ww,		// first key of ww tile in final_parent
+		unsigned int dim_cc,		// first key of cc tile in final_parent
+		unsigned int *final_parent,	// union-find forest of (tile,label) keys
+		const label_config *cfg		// connectivity and partition of the tiles
+						)
+{
+	unsigned int r, d;
+	if( cfg->partition )
+	{	// -P: the first column of cc is its halo, column 1 faces the last column of ww
+		for(r=1;r<nr;r++)
+			if( lm_cc[stride*r+1]!=0 )
+				for(d=r-(cfg->connectivity==8 && r>1); d<=r+(cfg->connectivity==8 && r+1<nr); d++)
+					if( lm_ww[stride*d+nc-1]!=0 )
+						record_equivalence( dim_cc+lm_cc[stride*r+1]-1, dim_ww+lm_ww[stride*d+nc-1]-1, final_parent );
+		return;
+	}
+	for(r=0;r<nr;r++)
+	{
+		if (lm_ww[stride*r+nc-1]!=0)
+			record_equivalence( dim_cc+lm_cc[stride*r]-1, dim_ww+lm_ww[stride*r+nc-1]-1, final_parent );
+	}
+}
+
+void objects_stitching_corner(
+		unsigned int *lm_nx,		// label matrix of the north-western (or north-eastern) tile
+		unsigned int *lm_cc,		// label matrix of target (=centre) tile in the mask
+		unsigned int east,		// 1 if lm_nx is the north-eastern tile
+		unsigned int nr,		// number of rows
+		unsigned int nc,		// number of columns
+		unsigned int stride,	// row pitch of the label raster
+		unsigned int dim_nx,		// first key of nx tile in final_parent
+		unsigned int dim_cc,		// first key of cc tile in final_parent
+		unsigned int *final_parent,	// union-find forest of (tile,label) keys
+		const label_config *cfg		// connectivity and partition of the tiles
+						)
+{
+	/*
+	 *	With -P and 8-connectivity, the first owned pixel of the corner of cc touches the
+	 *	last owned pixel of the diagonal tile of the previous row, which shares no seam
+	 *	with cc (without -P the pixel is in the row both tiles overlap).
+	 */
+	unsigned int a, b;
+	if( !cfg->partition || cfg->connectivity!=8 ) return;
+	a = lm_cc[stride+(east ? nc-1 : 1)];
+	b = lm_nx[stride*(nr-1)+(east ? 1 : nc-1)];
+	if( a!=0 && b!=0 ) record_equivalence( dim_cc+a-1, dim_nx+b-1, final_parent );
+}
+
+void objects_stitching_cc(
+		unsigned int dim_cc,			// first key of cc tile in final_parent
+		unsigned int *final_parent,		// union-find forest of (tile,label) keys
+		unsigned int maxcount			// number of (compact) labels in target tile
+						)
+{
+	/*
+	 *	Every label of the target tile enters the forest as a ROOT: labels were
+	 *	already compacted by relabel_equivalence, hence they are all distinct objects.
+	 */
+	unsigned int i;
+	for(i=0;i<maxcount;i++) final_parent[dim_cc+i] = dim_cc+i;
+}
+
+void record_cross_equivalence(
+		unsigned int **lm,
+		unsigned int *final_parent,
+		unsigned int nr,
+		unsigned int nc,
+		unsigned int stride,
 		unsigned int ntile_cc,
 		int ntile_nn,
 		int ntile_ww,
-		unsigned int *PARENT,
-		unsigned int mc)
+		unsigned int mc,
+		unsigned int *dim_cum,
+		const label_config *cfg)
+{
+	unsigned int *lm_cc;
+	unsigned int *lm_nn;
+	unsigned int *lm_ww;
+	lm_cc=lm[ntile_cc];
+	/*
+	 * For every tile, record equivalences in final_parent in following order:
+	 *
+	 *	(1) cc [always  existent]	---> objects_stitching_cc
+	 *	(2) nn [only if existent] 	---> objects_stitching_nn
+	 *	(3) ww [only if existent]	---> objects_stitching_ww
+	 *
+	 * Point (1) enters the labels of the target tile in the forest; points (2) and (3)
+	 * merge them with the objects crossing the northern and western borders, whose
+	 * tiles were already recorded.
+	 *
+	 */
+	// (1)
+	objects_stitching_cc(dim_cum[ntile_cc],final_parent,mc);
+	// (2)
+	if( ntile_nn>=0 ) {
+		lm_nn=lm[ntile_nn];
+		objects_stitching_nn(lm_nn,lm_cc, nr, nc, stride,dim_cum[ntile_nn], dim_cum[ntile_cc], final_parent, cfg);
+	}
+	// (3)
+	if( ntile_ww>=0 ) {
+		lm_ww=lm[ntile_ww];
+		objects_stitching_ww(lm_ww,lm_cc, nr, nc, stride,dim_cum[ntile_ww], dim_cum[ntile_cc], final_parent, cfg);
+	}
+}
+
+unsigned int relabel_cross_equivalence( unsigned int *final_parent, unsigned int dim )
+{
+	/*
+	 *	Since final_parent[k]<=k, visiting keys in increasing order lets every ROOT
+	 *	get the next overall image ID while every other key copies the (already
+	 *	assigned) ID of its parent. It works in place and returns the number of objects.
+	 */
+	unsigned int k,final_count=0;
+	for(k=0;k<dim;k++)
+	{
+		if( final_parent[k]==k )	final_parent[k] = ++final_count;
+		else						final_parent[k] = final_parent[final_parent[k]];
+	}
+	return final_count;
+}
+
+
+unsigned int *third_scan(
+				unsigned int	nrows,
+				unsigned int	ncols,
+				unsigned int	stride,
+				unsigned int	*lab_mat,
+				unsigned int	*cur_final_parent	)
+{
+	unsigned int r;
+	unsigned int c;
+	for(r=0; r<nrows; r++)
+		for(c=0; c<ncols; c++)
+			if(cc_pol(c,r)!=0) // if (r,c) is object pixel
+			{	//printf("%d<-%d\n",cc_pol(c,r), cur_final_parent[cc_pol(c,r)-1]);
+				cc_pol(c,r) = cur_final_parent[cc_pol(c,r)-1];
+			}
+	return lab_mat;
+}
+
+
+
+/*
+ *	THREAD POOL
+ *	Tiles are split in threads contiguous ranges, one per worker. A worker takes
+ *	tiles from the front of its own range and, once it is exhausted, steals the
+ *	back half of the range of another worker: uneven tiles (e.g. dense urban tiles
+ *	next to empty rural ones) are balanced without any central queue.
+ */
+//	-scratch memory of the calling worker (see worker_scratch)
+__thread void	*scratch_buf	= NULL;
+__thread size_t	scratch_size	= 0;
+__thread unsigned int	worker_id	= 0;	// of the calling worker in its run_tiles (see tiles_job.scratch)
+
+void *worker_scratch( size_t size )
+{
+	/*
+	 *	Per-thread arena: the buffer of the calling worker, grown to size bytes when
+	 *	needed and reused by all the tiles it processes (its content is not kept from
+	 *	one call to the next). It is released by free_worker_scratch when the worker ends.
+	 */
+	if( size>scratch_size )
+	{
+		free(scratch_buf);
+		scratch_buf = malloc(size);
+		if (scratch_buf == NULL) { printf("Error allocating scratch memory!\n"); exit(1); }
+		scratch_size = size;
+	}
+	return scratch_buf;
+}
+
+void free_worker_scratch( void )
+{
+	free(scratch_buf);
+	scratch_buf		= NULL;
+	scratch_size	= 0;
+}
+
+unsigned int pop_tile( tile_queue *q, unsigned int *iTile )
+{
+	unsigned int found = 0;
+	pthread_mutex_lock( &q->lock );
+	if( q->next < q->end ) { *iTile = q->next++; found = 1; }
+	pthread_mutex_unlock( &q->lock );
+	return found;
+}
+
+unsigned int steal_tiles( tile_queue *victim, tile_queue *thief )
+{
+	unsigned int n, lo=0, hi=0;
+	pthread_mutex_lock( &victim->lock );
+	n = victim->end - victim->next;
+	if( n > 0 )
+	{
+		hi = victim->end;
+		lo = hi - (n+1)/2;
+		victim->end = lo;
+	}
+	pthread_mutex_unlock( &victim->lock );
+	if( n == 0 ) return 0;
+	pthread_mutex_lock( &thief->lock );
+	thief->next = lo;
+	thief->end	= hi;
+	pthread_mutex_unlock( &thief->lock );
+	return 1;
+}
+
+void *tile_worker( void *args )
+{
+	tile_worker_args *w = (tile_worker_args*)args;
+	unsigned int iTile, k;
+	worker_id = w->id;
+	while(1)
+	{
+		while( pop_tile( &w->queues[w->id], &iTile ) ) w->kernel( iTile, w->job );
+		// own range exhausted: look for a victim, starting from the next worker
+		for(k=1;k<w->nWorkers;k++) if( steal_tiles( &w->queues[(w->id+k)%w->nWorkers], &w->queues[w->id] ) ) break;
+		if( k==w->nWorkers ) break; // nothing left anywhere
+	}
+	free_worker_scratch();
+	return NULL;
+}
+
+int run_tiles( unsigned int threads, unsigned int nTiles, void (*kernel)(unsigned int, void*), void *job )
+{
+	/*
+	 *	kernel on the nTiles tiles of job, by threads workers. A worker that cannot start
+	 *	exits the command line; in library builds its range is left to the other workers,
+	 *	which do all the tiles anyway, and the error of pthread_create is returned (see
+	 *	ccl_label). It returns 0 otherwise.
+	 */
+	unsigned int	iTile, k, started, nWorkers = _min( threads, nTiles );
+	int				err = 0;
+	if( nWorkers <= 1 )
+	{
+		worker_id = 0;
+		for(iTile=0;iTile<nTiles;iTile++) kernel( iTile, job );
+		free_worker_scratch();
+		return 0;
+	}
+	pthread_t			workers[nWorkers];
+	tile_queue			queues[nWorkers];
+	tile_worker_args	args[nWorkers];
+	for(k=0;k<nWorkers;k++)
+	{
+		pthread_mutex_init( &queues[k].lock, NULL );
+		queues[k].next	= (unsigned long)nTiles* k   /nWorkers;
+		queues[k].end	= (unsigned long)nTiles*(k+1)/nWorkers;
+		args[k].queues	= queues;
+		args[k].nWorkers= nWorkers;
+		args[k].id		= k;
+		args[k].kernel	= kernel;
+		args[k].job		= job;
+	}
+	// the calling thread is worker 0
+	for(started=1;started<nWorkers;started++)
+		if( (err=pthread_create( &workers[started], NULL, tile_worker, &args[started] )) )
+		{
+#ifndef CCL_LIBRARY
+			printf("Error creating thread: %s\n",strerror(err)); exit(1);
+#endif
+			break;
+		}
+	tile_worker( &args[0] );
+	for(k=1;k<started;k++) pthread_join( workers[k], NULL );
+	for(k=0;k<nWorkers;k++) pthread_mutex_destroy( &queues[k].lock );
+	return err;
+}
+
+void pack_tile_row( unsigned int ntY, void *job )
+{
+	/*
+	 *	Pack the rows of the mapped/TIFF image starting the ntY-th row of tiles in the
+	 *	mask (the last row of tiles takes the rows below too): rows of different
+	 *	calls do not share words, so they can run concurrently.
+	 */
+	tiles_job *J = (tiles_job*)job;
+	unsigned int row0 = ntY*(J->tiledimY-1);
+	packed_mat rows = packed_view(J->mask, row0, 0, (ntY==J->ntilesY-1) ? J->mask->nrows-row0 : J->tiledimY-1, J->NC);
+	if( J->map!=NULL ) pack_map(J->map, &rows, row0, J->classes);
+	else tiff_pack(J->tiff, &rows, row0, J->classes);
+}
+
+/*
+ *	TILE CACHE
+ *	The first stage of a tile depends only on its pixels and the connectivity (and,
+ *	for the statistics, on its halo and on which rows/columns it owns). The result
+ *	(compact labels, count and statistics relative to the tile) is kept in cache_dir,
+ *	one file per distinct content named by its hash: a rerun on a raster that is mostly the same, or tiles
+ *	with the same pixels (e.g. empty ones), read it back instead of scanning. The
+ *	pixels are stored too and compared on load, so a collision of the hash is a miss.
+ */
+uint64_t tile_hash( packed_mat *P, cache_header *key )
+{
+	unsigned int	r, c, k;
+	uint64_t		h = 0xcbf29ce484222325ULL;
+	uint32_t		*f = &key->nrows;
+	for(k=0;k<CACHE_KEY;k++) { h ^= f[k]; h *= 0x100000001b3ULL; }
+	for(r=0;r<P->nrows;r++)
+		for(c=0;c<P->ncols;c+=64)
+		{
+			h ^= packed_word(P,r,c);
+			h *= 0x9E3779B97F4A7C15ULL;
+			h ^= h>>29;
+		}
+	return h;
+}
+
+void cache_path( char *path, size_t len, char *dir, uint64_t hash )
+{
+	snprintf( path, len, "%s/%016llx.tile", dir, (unsigned long long)hash );
+}
+
+unsigned int cache_load(
+		tiles_job		*J,
+		unsigned int	iTile,
+		packed_mat		*halo,		// the tile and its halo
+		cache_header	*key,		// size and ownership of the tile
+		uint64_t		hash,
+		unsigned int	row0,		// the statistics are stored relative to the
+		unsigned int	col0	)	// tile, (row0,col0) is pixel (1,1) in the image
+{
+	/*
+	 *	Read the first stage of the tile from the cache into the label raster, J->mc and
+	 *	J->stats. Returns 0 (and leaves the tile untouched) if the tile is not cached.
+	 */
+	char			path[4096];
+	cache_header	h;
+	unsigned int	r, c, k, nw = (key->ncols+63)/64;
+	uint64_t		w;
+	size_t			nlab = (size_t)key->tiledimY*key->tiledimX, nb;
+	unsigned char	*buf;
+	unsigned int	*lab_mat = J->lab_mat[iTile], stride = J->stride;
+	comp_stats		*st = NULL;
+	FILE			*fid;
+	cache_path( path, sizeof(path), J->cfg.cache_dir, hash );
+	fid = fopen(path,"rb");
+	if( fid==NULL ) return 0;
+	if( fread(&h,sizeof(h),1,fid)!=1 || memcmp(h.magic,CACHE_MAGIC,4) || memcmp(&h.nrows,&key->nrows,CACHE_KEY*sizeof(uint32_t))
+		|| (J->stats!=NULL && !h.has_stats) ) { fclose(fid); return 0; }
+	for(r=0;r<key->nrows;r++)
+		for(k=0;k<nw;k++)
+			if( fread(&w,sizeof(w),1,fid)!=1 || w!=packed_word(halo,r,64*k) ) { fclose(fid); return 0; }
+	if( h.has_stats )
+	{
+		if( J->stats!=NULL )
+		{
+			st = (comp_stats*)malloc(_max(h.mc,1)*sizeof(comp_stats));
+			if( fread(st,sizeof(comp_stats),h.mc,fid)!=h.mc ) { free(st); fclose(fid); return 0; }
+		}
+		else fseek(fid, (long)h.mc*sizeof(comp_stats), SEEK_CUR);
+	}
+	nb	= nlab*(h.nbits/8);
+	buf	= (unsigned char*)worker_scratch( nb );
+	if( fread(buf,1,nb,fid)!=nb ) { free(st); fclose(fid); return 0; }
+	fclose(fid);
+	for(k=0,r=0;r<key->tiledimY;r++)
+		for(c=0;c<key->tiledimX;c++,k++)
+			cc_pol(c,r) = (h.nbits==8) ? buf[k] : (h.nbits==16) ? ((uint16_t*)buf)[k] : ((uint32_t*)buf)[k];
+	J->mc[iTile] = h.mc;
+	if( st!=NULL )
+	{
+		for(k=0;k<h.mc;k++)
+			if( st[k].area>0 )
+			{
+				st[k].sum_r	+= st[k].area*row0;		st[k].sum_c	+= st[k].area*col0;
+				st[k].min_r	+= row0;				st[k].min_c	+= col0;
+				st[k].max_r	+= row0;				st[k].max_c	+= col0;
+			}
+		J->stats[iTile] = st;
+	}
+	return 1;
+}
+
+void cache_store(
+		tiles_job		*J,
+		unsigned int	iTile,
+		packed_mat		*halo,
+		cache_header	*key,
+		uint64_t		hash,
+		unsigned int	row0,
+		unsigned int	col0	)
+{
+	/*
+	 *	Write the first stage of the tile in the cache (see cache_load): header, pixels
+	 *	of the tile and its halo, statistics relative to the tile and labels (8, 16 or 32
+	 *	bits). The file is written aside and renamed, so that workers storing tiles with
+	 *	the same pixels, or another process reading the cache, never see it half written.
+	 */
+	char			path[4096], tmp[4096+32];
+	cache_header	h = *key;
+	unsigned int	r, c, k, nw = (key->ncols+63)/64;
+	uint64_t		w;
+	size_t			nlab = (size_t)key->tiledimY*key->tiledimX, nb;
+	unsigned char	*buf;
+	unsigned int	*lab_mat = J->lab_mat[iTile], stride = J->stride;
+	comp_stats		st;
+	FILE			*fid;
+	memcpy( h.magic, CACHE_MAGIC, 4 );
+	h.mc		= J->mc[iTile];
+	h.nbits		= (h.mc<0x100) ? 8 : (h.mc<0x10000) ? 16 : 32;
+	h.has_stats	= J->stats!=NULL;
+	cache_path( path, sizeof(path), J->cfg.cache_dir, hash );
+	snprintf( tmp, sizeof(tmp), "%s.%d.%u", path, (int)getpid(), iTile );
+	fid = fopen(tmp,"wb");
+	if (fid == NULL) { printf("Error opening file %s!\n",tmp); exit(1); }
+	if( fwrite(&h,sizeof(h),1,fid)!=1 ) { printf("Error writing file %s!\n",tmp); exit(1); }
+	for(r=0;r<key->nrows;r++)
+		for(k=0;k<nw;k++)
+		{
+			w = packed_word(halo,r,64*k);
+			if( fwrite(&w,sizeof(w),1,fid)!=1 ) { printf("Error writing file %s!\n",tmp); exit(1); }
+		}
+	for(k=0;h.has_stats && k<h.mc;k++)
+	{
+		st = J->stats[iTile][k];
+		if( st.area>0 )
+		{
+			st.sum_r	-= st.area*row0;		st.sum_c	-= st.area*col0;
+			st.min_r	-= row0;				st.min_c	-= col0;
+			st.max_r	-= row0;				st.max_c	-= col0;
+		}
+		if( fwrite(&st,sizeof(st),1,fid)!=1 ) { printf("Error writing file %s!\n",tmp); exit(1); }
+	}
+	nb	= nlab*(h.nbits/8);
+	buf	= (unsigned char*)worker_scratch( nb );
+	for(k=0,r=0;r<key->tiledimY;r++)
+		for(c=0;c<key->tiledimX;c++,k++)
+		{
+			if		( h.nbits==8 )	buf[k] = cc_pol(c,r);
+			else if	( h.nbits==16 )	((uint16_t*)buf)[k] = cc_pol(c,r);
+			else					((uint32_t*)buf)[k] = cc_pol(c,r);
+		}
+	if( fwrite(buf,1,nb,fid)!=nb ) { printf("Error writing file %s!\n",tmp); exit(1); }
+	fclose(fid);
+	if( rename(tmp,path) ) { printf("Error renaming file %s: %s\n",tmp,strerror(errno)); exit(1); }
+}
+
+void intra_tile_labeling( unsigned int iTile, void *job )
+{
+	tiles_job *J = (tiles_job*)job;
+	unsigned int row0 = (iTile/J->ntilesX)*(J->tiledimY-1), col0 = (iTile%J->ntilesX)*(J->tiledimX-1);
+	unsigned int maxcount;
+	uint64_t hash = 0;
+	void *classes = NULL;
+	tile_stats ts, *pts = NULL;
+	tile_trace *tr = (J->trace!=NULL) ? &J->trace[iTile] : NULL;
+	cache_header key;
+	// the tile is a view of the mask (no copy), the halo adds the next row and column; with -P
+	// the tile scanned is the part it owns, the first row/column are a read-only halo
+	unsigned int part = J->cfg.partition;
+	packed_mat urban = packed_view(J->mask, row0+part, col0+part, J->tiledimY-part, J->tiledimX-part);
+	unsigned int *lab = J->lab_mat[iTile] + part*(J->stride+1);
+	ts.halo		= packed_view(J->mask, row0, col0, _min(J->tiledimY+1, J->mask->nrows-row0), _min(J->tiledimX+1, J->NC-col0));
+	ts.row0		= J->mask_row0 + row0;
+	ts.col0		= col0;
+	ts.first	= !part;
+	ts.last_r	= _min( J->tiledimY-1, J->NR-2-ts.row0 ) - part;
+	ts.last_c	= _min( J->tiledimX-1, J->NC-2-ts.col0 ) - part;
+	// TILE CACHE
+	if( J->cfg.cache_dir!=NULL )
+	{
+		key = (cache_header){ CACHE_MAGIC, ts.halo.nrows, ts.halo.ncols, J->tiledimY, J->tiledimX, ts.last_r, ts.last_c, J->cfg.connectivity, part, 0, 0, 0 };
+		hash = tile_hash( &ts.halo, &key );
+		if( cache_load( J, iTile, &ts.halo, &key, hash, ts.row0, ts.col0 ) )
+		{
+			if( tr ) *tr = (tile_trace){ 0, 0, 0, 0, 1 };
+			return;
+		}
+	}
+	// INITIALIZATION: labels go in place in the raster, statistics and PARENT are scratch of the worker
+	size_t stats_size = (J->stats!=NULL) ? (J->nID+1)*sizeof(comp_stats) : 0;
+	unsigned char *scratch	= (J->scratch!=NULL) ? J->scratch[worker_id]
+							: (unsigned char*)worker_scratch( stats_size + (J->nID + 3*J->tiledimX+6)*sizeof(unsigned int) );
+	unsigned int *PARENT	= (unsigned int*)(scratch + stats_size);
+	if( J->stats!=NULL )
+	{
+		ts.s		= (comp_stats*)scratch;
+		pts			= &ts;
+	}
+
+	// KERNELs INVOCATION (timed if traced):
+	if( J->classes!=NULL ) classes = class_ptr(J->classes, row0, col0);
+	if( tr ) tr->first_scan = wall_time();
+	maxcount = J->cfg.scan(&urban,classes,J->classes ? J->classes->stride : 0,lab,J->stride,PARENT,PARENT+J->nID,pts);	//	(1) 1st SCAN
+	//																						//	(2) UNION ==> done on the fly by record_equivalence
+	if( tr ) tr->relabel = wall_time();
+	J->mc[iTile] = relabel_equivalence(	maxcount, PARENT);														//	(3) RELABEL & COMPACT
+	if( tr ) tr->second_scan = wall_time();
+	second_scan(J->lab_mat[iTile],J->tiledimY,J->tiledimX,J->stride, PARENT);								//	(4) 2nd SCAN
+	if( tr )
+	{	// start times to durations
+		double t = wall_time();
+		tr->first_scan	= tr->relabel - tr->first_scan;
+		tr->relabel		= tr->second_scan - tr->relabel;
+		tr->second_scan	= t - tr->second_scan;
+		tr->provisional	= maxcount;
+		tr->cached		= 0;
+	}
+	if( J->stats!=NULL )
+	{	// statistics of the compact labels outlive the scratch
+		compact_stats(ts.s, maxcount, PARENT);
+		J->stats[iTile] = (comp_stats*)malloc(_max(J->mc[iTile],1)*sizeof(comp_stats));
+		memcpy(J->stats[iTile], ts.s, J->mc[iTile]*sizeof(comp_stats));
+	}
+	if( J->cfg.cache_dir!=NULL ) cache_store( J, iTile, &ts.halo, &key, hash, ts.row0, ts.col0 );
+}
+
+void final_tile_labeling( unsigned int iTile, void *job )
+{
+	tiles_job *J = (tiles_job*)job;
+	// the metrics are swept in the same pass, while the tile still has its compact labels
+	if( J->metrics!=NULL ) tile_metrics_sweep(J, iTile, &J->metrics[iTile]);
+	third_scan(J->tiledimY, J->tiledimX, J->stride, J->lab_mat[iTile], J->final_parent+J->dim_cum[iTile]);
+}
+
+void cross_tile_labeling( unsigned int iTile, void *job )
+{
+	tiles_job *J = (tiles_job*)job;
+	objects_stitching_cc(J->dim_cum[iTile],J->final_parent,J->mc[iTile]);
+}
+
+void merge_block( unsigned int iBlock, void *job )
+{
+	/*
+	 *	Merge the (up to) 2x2 sub-blocks of J->block x J->block tiles forming the
+	 *	iBlock-th block of the current level, by stitching the tiles along the two
+	 *	inner seams only:
+	 *
+	 *			 NW  |  NE
+	 *			-----+-----		(ww seam: vertical line, nn seam: horizontal line)
+	 *			 SW  |  SE
+	 *
+	 *	The sub-blocks were already merged at the previous level and their outer
+	 *	perimeter is read straight from the boundary rows/columns of lab_mat. Since
+	 *	the forest of every block only points to keys of its own tiles, blocks of the
+	 *	same level never touch the same entries of final_parent.
+	 */
+	tiles_job *J = (tiles_job*)job;
+	unsigned int s			= J->block;
+	unsigned int nbX		= (J->ntilesX + 2*s-1) / (2*s);
+	unsigned int x0			= (iBlock % nbX) * 2*s;
+	unsigned int y0			= (iBlock / nbX) * 2*s;
+	unsigned int x1			= _min( x0+2*s, J->ntilesX );
+	unsigned int y1			= _min( y0+2*s, J->ntilesY );
+	unsigned int x,y,iTile;
+	// ww seam between western and eastern sub-blocks
+	if( x0+s < x1 )
+		for(y=y0;y<y1;y++)
+		{
+			iTile = y*J->ntilesX + x0+s;
+			objects_stitching_ww(J->lab_mat[iTile-1],J->lab_mat[iTile],J->tiledimY,J->tiledimX,J->stride,J->dim_cum[iTile-1],J->dim_cum[iTile],J->final_parent,&J->cfg);
+			if( y==y0 ) continue;
+			// -P: the diagonals across the seam
+			objects_stitching_corner(J->lab_mat[iTile-J->ntilesX-1],J->lab_mat[iTile],0,J->tiledimY,J->tiledimX,J->stride,J->dim_cum[iTile-J->ntilesX-1],J->dim_cum[iTile],J->final_parent,&J->cfg);
+			objects_stitching_corner(J->lab_mat[iTile-J->ntilesX],J->lab_mat[iTile-1],1,J->tiledimY,J->tiledimX,J->stride,J->dim_cum[iTile-J->ntilesX],J->dim_cum[iTile-1],J->final_parent,&J->cfg);
+		}
+	// nn seam between northern and southern sub-blocks
+	if( y0+s < y1 )
+		for(x=x0;x<x1;x++)
+		{
+			iTile = (y0+s)*J->ntilesX + x;
+			objects_stitching_nn(J->lab_mat[iTile-J->ntilesX],J->lab_mat[iTile],J->tiledimY,J->tiledimX,J->stride,J->dim_cum[iTile-J->ntilesX],J->dim_cum[iTile],J->final_parent,&J->cfg);
+			// -P: the diagonals across the seam, but at the centre (done with the ww seam)
+			if( x>x0 && x!=x0+s )
+				objects_stitching_corner(J->lab_mat[iTile-J->ntilesX-1],J->lab_mat[iTile],0,J->tiledimY,J->tiledimX,J->stride,J->dim_cum[iTile-J->ntilesX-1],J->dim_cum[iTile],J->final_parent,&J->cfg);
+			if( x+1<x1 && x+1!=x0+s )
+				objects_stitching_corner(J->lab_mat[iTile-J->ntilesX+1],J->lab_mat[iTile],1,J->tiledimY,J->tiledimX,J->stride,J->dim_cum[iTile-J->ntilesX+1],J->dim_cum[iTile],J->final_parent,&J->cfg);
+		}
+}
+
+void hierarchical_cross_equivalence( tiles_job *J )
+{
+	/*
+	 *	Divide-and-conquer alternative to calling record_cross_equivalence tile by tile:
+	 *	all tiles first enter the forest concurrently, then blocks of 2x2 tiles, 4x4
+	 *	tiles, ... are merged level by level, each level in parallel over its blocks.
+	 *	Unions always link towards the smaller key, so the final_parent produced is
+	 *	the same of the raster-order merge.
+	 */
+	unsigned int nTiles = J->ntilesX*J->ntilesY;
+	int err;
+	if( (err=run_tiles( J->cfg.threads, nTiles, cross_tile_labeling, J )) ) J->thread_error = err;
+	for(J->block=1; J->block<J->ntilesX || J->block<J->ntilesY; J->block*=2)
+	{
+		if( (err=run_tiles( J->cfg.threads, ((J->ntilesX+2*J->block-1)/(2*J->block)) * ((J->ntilesY+2*J->block-1)/(2*J->block)), merge_block, J )) )
+			J->thread_error = err;
+	}
+}
+
+unsigned int cross_tile_equivalence( tiles_job *J )
+{
+	/*
+	 *	Second stage on the labelled tiles: the keys of every tile follow the keys of
+	 *	the previous tiles, final_parent is built (tile by tile in raster order or
+	 *	hierarchically) and relabelled. Returns the number of objects.
+	 *	final_parent is allocated, unless J has one with room for all the keys (the
+	 *	library keeps it from one mask to the next, see ccl_label).
+	 */
+	unsigned int nTiles = J->ntilesX*J->ntilesY;
+	unsigned int iTile, rr, nn, ww, dim;
+	J->dim_cum[0] = 0;
+	dim = J->mc[0];
+	for(iTile = 1;iTile<nTiles;iTile++)
+	{
+		dim += J->mc[iTile];
+		J->dim_cum[iTile] = J->dim_cum[iTile-1] + J->mc[iTile-1];
+	}
+	if( J->final_parent==NULL )
+	{
+		J->final_parent = (unsigned int*)calloc(_max(dim,1),sizeof(unsigned int));
+		if (J->final_parent == NULL) { printf("Error allocating final_parent!\n"); exit(1); }
+	}
+	else memset( J->final_parent, 0, _max(dim,1)*sizeof(unsigned int) );
+	if( J->cfg.hierarchical ) hierarchical_cross_equivalence( J );
+	else for(iTile = 0;iTile<nTiles;iTile++)
+	{
+		rr = iTile / J->ntilesX;					// CURRENT ROW (quoziente intero)
+		nn = iTile - J->ntilesX;					// tile index of nn
+		ww = ((rr*J->ntilesX)==iTile)?-1:iTile-1;	// tile index of ww
+		record_cross_equivalence(J->lab_mat,J->final_parent,J->tiledimY,J->tiledimX,J->stride,iTile, nn, ww, J->mc[iTile],J->dim_cum,&J->cfg);
+		if( rr==0 ) continue;
+		// -P: the diagonal tiles of the previous row
+		if( (int)ww>=0 )
+			objects_stitching_corner(J->lab_mat[nn-1],J->lab_mat[iTile],0,J->tiledimY,J->tiledimX,J->stride,J->dim_cum[nn-1],J->dim_cum[iTile],J->final_parent,&J->cfg);
+		if( iTile+1<(rr+1)*J->ntilesX )
+			objects_stitching_corner(J->lab_mat[nn+1],J->lab_mat[iTile],1,J->tiledimY,J->tiledimX,J->stride,J->dim_cum[nn+1],J->dim_cum[iTile],J->final_parent,&J->cfg);
+	}
+	J->nobjects = relabel_cross_equivalence( J->final_parent, dim );
+	return J->nobjects;
+}
+
+void write_tile_row( unsigned int ntY, void *job )
+{
+	tiles_job *J = (tiles_job*)job;
+	unsigned int *rows = (unsigned int*)worker_scratch((size_t)(J->tiledimY-1)*(J->NC-2)*sizeof(unsigned int));
+	unsigned int nr = tile_row_labels(J, ntY, rows);
+	write_labels(J->writer, ntY*(J->tiledimY-1), nr, rows);
+}
+
+void window_row_metrics( unsigned int iRow, void *job )
+{
+	/*
+	 *	Metrics of the moving windows of the iRow-th row of the grid: one window every
+	 *	win_step pixels, centred in its step (see win_center) and win_size pixels wide,
+	 *	clipped to the image. The windows read the final labels of the tiles, so that a patch is an
+	 *	object of the whole image clipped to the window and nothing is relabelled (an
+	 *	object leaving and entering the window again is one patch). The pixels of every
+	 *	object in the window are counted in count, indexed by label, and the labels seen
+	 *	are listed in seen to reset count after the window.
+	 */
+	tiles_job		*J = (tiles_job*)job;
+	unsigned int	nr = J->NR-2, nc = J->NC-2;		// size of the image
+	unsigned int	*count	= (unsigned int*)worker_scratch( ((size_t)J->nobjects+1 + J->nobjects + 2*J->win_size)*sizeof(unsigned int) );
+	unsigned int	*seen	= count + J->nobjects+1;
+	unsigned int	*cur	= seen + J->nobjects;	// labels of the current and previous row of the window
+	unsigned int	*prev	= cur + J->win_size, *tmp, *row;
+	unsigned int	j, k, r, c, e, r0, r1, c0, c1, ntY, ntX, l, nseen;
+	uint64_t		sealed, edges, largest, A;
+	double			sum2;
+	float			*w;
+	long			center;
+	memset( count, 0, ((size_t)J->nobjects+1)*sizeof(unsigned int) );
+	center	= win_center(iRow,J->win_step,nr);
+	r0		= (unsigned int)_max( center-(long)(J->win_size/2), 0 );
+	r1		= (unsigned int)_min( center-(long)(J->win_size/2)+(long)J->win_size, (long)nr );
+	for(j=0;j<J->win_cols;j++)
+	{
+		center	= win_center(j,J->win_step,nc);
+		c0		= (unsigned int)_max( center-(long)(J->win_size/2), 0 );
+		c1		= (unsigned int)_min( center-(long)(J->win_size/2)+(long)J->win_size, (long)nc );
+		sealed = edges = largest = 0; sum2 = 0; nseen = 0;
+		for(r=r0;r<r1;r++)
+		{
+			// pixel (r,c) of the image is owned by tile (r/(tiledimY-1),c/(tiledimX-1)), see write_mat:
+			// the row of the window is gathered tile by tile
+			ntY = r/(J->tiledimY-1);
+			for(c=c0;c<c1;c=e)
+			{
+				ntX	= c/(J->tiledimX-1);
+				e	= _min( c1, (ntX+1)*(J->tiledimX-1) );
+				row	= J->lab_mat[ntY*J->ntilesX+ntX] + (size_t)(r-ntY*(J->tiledimY-1)+1)*J->stride + 1 - ntX*(J->tiledimX-1);
+				memcpy( cur+c-c0, row+c, (e-c)*sizeof(unsigned int) );
+			}
+			for(c=0;c<c1-c0;c++)
+			{
+				l = cur[c];
+				if( l!=Vb )
+				{
+					if( count[l]++==0 ) seen[nseen++] = l;
+					sealed++;
+				}
+				if( r>r0 && (l!=Vb)!=(prev[c]!=Vb) ) edges++;
+				if( c>0 && (l!=Vb)!=(cur[c-1]!=Vb) ) edges++;
+			}
+			tmp = prev; prev = cur; cur = tmp;
+		}
+		for(k=0;k<nseen;k++)
+		{
+			largest	= _max( largest, count[seen[k]] );
+			sum2	+= (double)count[seen[k]]*count[seen[k]];
+			count[seen[k]] = 0;
+		}
+		A = (uint64_t)(r1-r0)*(c1-c0);
+		w = J->windows + ((size_t)iRow*J->win_cols+j)*WIN_METRICS;
+		w[WIN_SEALED]	= 100.0*sealed/A;
+		w[WIN_PATCHES]	= nseen;
+		w[WIN_LPI]		= 100.0*largest/A;
+		w[WIN_ED]		= (double)edges/A;
+		w[WIN_MESH]		= sum2/A;
+	}
+}
+
+void sweep_tile_metrics( unsigned int iTile, void *job )
+{
+	tiles_job *J = (tiles_job*)job;
+	tile_metrics_sweep(J, iTile, &J->metrics[iTile]);
+}
+
+uint16_t *object_classes( tiles_job *J, unsigned int nobjects )
+{
+	/*
+	 *	Class of every object (multi-class labeling), read at any of its pixels: the
+	 *	tiles still have their compact labels, which final_parent maps to the objects.
+	 */
+	uint16_t		*cls = (uint16_t*)calloc((size_t)nobjects+1,sizeof(uint16_t));
+	unsigned int	iTile, row0, col0, last_r, last_c, r, c, l, id;
+	unsigned int	*lab_mat, stride = J->stride;
+	for(iTile=0;iTile<J->ntilesX*J->ntilesY;iTile++)
+	{
+		row0	= (iTile/J->ntilesX)*(J->tiledimY-1);	col0 = (iTile%J->ntilesX)*(J->tiledimX-1);
+		last_r	= _min( J->tiledimY-1, J->NR-2-row0 );	last_c = _min( J->tiledimX-1, J->NC-2-col0 );
+		lab_mat	= J->lab_mat[iTile];
+		for(r=1;r<=last_r;r++)
+			for(c=1;c<=last_c;c++)
+				if( (l=cc_pol(c,r))!=Vb && cls[id=J->final_parent[J->dim_cum[iTile]+l-1]]==0 )
+					cls[id] = (J->classes->nbytes==1) ? *(uint8_t*)class_ptr(J->classes,row0+r,col0+c) : *(uint16_t*)class_ptr(J->classes,row0+r,col0+c);
+	}
+	return cls;
+}
+
+unsigned int same_packed( packed_mat *a, packed_mat *b )
+{
+	// 1 if the two masks (of the same size) have the same pixels
+	unsigned int r, c;
+	for(r=0;r<a->nrows;r++)
+		for(c=0;c<a->ncols;c+=64)
+			if( packed_word(a,r,c)!=packed_word(b,r,c) ) return 0;
+	return 1;
+}
+
+int cmp_uint64( const void *a, const void *b )
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x>y) - (x<y);
+}
+
+int cmp_overlap( const void *a, const void *b )
+{
+	const overlap *x = (const overlap*)a, *y = (const overlap*)b;
+	if( x->id0!=y->id0 ) return (x->id0<y->id0) ? -1 : 1;
+	if( x->id1!=y->id1 ) return (x->id1<y->id1) ? -1 : 1;
+	return 0;
+}
+
+void update_tile_labeling( unsigned int iTile, void *job )
+{
+	/*
+	 *	Second epoch of a tile: if its pixels and halo (the next row and column, read
+	 *	by the statistics) are those of the first epoch, it keeps labels, count and
+	 *	statistics. Otherwise it is labelled again in the raster of the changed tiles
+	 *	and the overlaps of its labels with those of the first epoch are counted on the
+	 *	pixels it owns, as pairs {label of epoch 0, label of epoch 1} sorted and counted.
+	 */
+	update_job		*U = (update_job*)job;
+	tiles_job		*J = U->J;
+	unsigned int	ntY = iTile/J->ntilesX, ntX = iTile%J->ntilesX;
+	unsigned int	row0 = ntY*(J->tiledimY-1), col0 = ntX*(J->tiledimX-1);
+	unsigned int	nr = _min(J->tiledimY+1, J->mask->nrows-row0), nc = _min(J->tiledimX+1, J->NC-col0);
+	unsigned int	last_r = _min( J->tiledimY-1, J->NR-2-row0 );
+	unsigned int	last_c = _min( J->tiledimX-1, J->NC-2-col0 );
+	unsigned int	r, c, k, n, l0, l1, *lab0, *lab1;
+	uint64_t		*keys;
+	packed_mat		a = packed_view(U->prev_mask, row0, col0, nr, nc);
+	packed_mat		b = packed_view(J->mask, row0, col0, nr, nc);
+	U->changed[iTile] = !same_packed(&a, &b);
+	if( !U->changed[iTile] )
+	{
+		if( U->area!=NULL ) U->area[iTile] = U->prev_area[iTile];
+		return;
+	}
+	if( J->stats!=NULL ) free(J->stats[iTile]);
+	J->lab_mat[iTile] = U->labels + (size_t)ntY*J->tiledimY*J->stride + ntX*J->tiledimX;
+	intra_tile_labeling( iTile, J );
+	if( U->area==NULL ) return;
+	tile_metrics_sweep( J, iTile, &U->area[iTile] );
+	// overlaps of the labels of the two epochs, as keys {l0,l1}
+	lab0 = U->prev_lab_mat[iTile];
+	lab1 = J->lab_mat[iTile];
+	keys = (uint64_t*)worker_scratch( (size_t)last_r*last_c*sizeof(uint64_t) );
+	for(n=0,r=1;r<=last_r;r++)
+		for(c=1;c<=last_c;c++)
+		{
+			l0 = lab0[(size_t)r*J->stride+c];
+			l1 = lab1[(size_t)r*J->stride+c];
+			if( l0!=Vb && l1!=Vb ) keys[n++] = ((uint64_t)l0<<32) | l1;
+		}
+	qsort( keys, n, sizeof(uint64_t), cmp_uint64 );
+	U->overlaps[iTile] = (overlap*)malloc(_max(n,1)*sizeof(overlap));
+	for(k=0,r=0;r<n;r++)
+	{
+		if( r>0 && keys[r]==keys[r-1] ) { U->overlaps[iTile][k-1].n++; continue; }
+		U->overlaps[iTile][k].id0	= keys[r]>>32;
+		U->overlaps[iTile][k].id1	= keys[r] & 0xFFFFFFFF;
+		U->overlaps[iTile][k].n		= 1;
+		k++;
+	}
+	U->noverlaps[iTile] = k;
+}
+
+unsigned int update_labeling(
+		tiles_job		*J,				// I/O: the tiles labelled on the first mask -> on mask1
+		packed_mat		*mask1,			// I: mask of the second epoch
+		char			*changes_file,	// O: correspondence of the objects (NULL: none)
+		unsigned int	**labels1		)	// O: label raster of the tiles that changed
+{
+	/*
+	 *	TWO EPOCHS. J holds the tiles of the first epoch after the second stage (J->lab_mat
+	 *	with the compact labels of the tiles, J->final_parent relabelled). The tiles equal
+	 *	in the two masks keep their labels and PARENT-compacted count, so that only the
+	 *	tiles that changed run the first stage again; then all seams are stitched again,
+	 *	since they are a small fraction of the pixels. J ends up describing the second
+	 *	epoch and the number of its objects is returned.
+	 *	The objects of the two epochs are matched through the pixels they share: on the
+	 *	tiles that did not change every label overlaps itself by its area, on the others
+	 *	the pairs are counted by update_tile_labeling (see write_changes).
+	 */
+	unsigned int	nTiles = J->ntilesX*J->ntilesY;
+	unsigned int	iTile, l, k, nobj0 = J->nobjects, nobj1;
+	unsigned int	*final_parent0 = J->final_parent;
+	unsigned int	mc0[nTiles], dim_cum0[nTiles];
+	size_t			n, m;
+	uint64_t		*area0, *area1;
+	overlap			*ov = NULL;
+	update_job		U = { J, J->mask, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+
+	memcpy( mc0, J->mc, nTiles*sizeof(unsigned int) );
+	memcpy( dim_cum0, J->dim_cum, nTiles*sizeof(unsigned int) );
+	if( changes_file!=NULL )
+	{	// pixels of the labels of the first epoch
+		U.prev_area		= (tile_metrics*)malloc(nTiles*sizeof(tile_metrics));
+		U.area			= (tile_metrics*)malloc(nTiles*sizeof(tile_metrics));
+		U.overlaps		= (overlap**)calloc(nTiles,sizeof(overlap*));
+		U.noverlaps		= (unsigned int*)calloc(nTiles,sizeof(unsigned int));
+		J->metrics		= U.prev_area;
+		run_tiles( J->cfg.threads, nTiles, sweep_tile_metrics, J );
+		J->metrics		= NULL;
+	}
+
+	// FIRST STAGE on the tiles that changed
+	*labels1		= (unsigned int*)calloc((size_t)J->ntilesY*J->tiledimY*J->stride,sizeof(unsigned int));
+	if (*labels1 == NULL) { printf("Error allocating the labels!\n"); exit(1); }
+	U.labels		= *labels1;
+	U.prev_lab_mat	= (unsigned int**)malloc(nTiles*sizeof(unsigned int*));
+	U.changed		= (unsigned char*)malloc(nTiles);
+	memcpy( U.prev_lab_mat, J->lab_mat, nTiles*sizeof(unsigned int*) );
+	J->mask			= mask1;
+	run_tiles( J->cfg.threads, nTiles, update_tile_labeling, &U );
+
+	// SECOND STAGE (the first epoch stays in final_parent0)
+	J->final_parent	= NULL;
+	nobj1			= cross_tile_equivalence( J );
+
+	// CORRESPONDENCE of the objects
+	if( changes_file!=NULL )
+	{
+		area0 = (uint64_t*)calloc(nobj0+1,sizeof(uint64_t));
+		area1 = (uint64_t*)calloc(nobj1+1,sizeof(uint64_t));
+		for(n=0,iTile=0;iTile<nTiles;iTile++) n += U.changed[iTile] ? U.noverlaps[iTile] : mc0[iTile];
+		ov = (overlap*)malloc(_max(n,1)*sizeof(overlap));
+		for(n=0,iTile=0;iTile<nTiles;iTile++)
+		{
+			for(l=0;l<mc0[iTile];l++) area0[final_parent0[dim_cum0[iTile]+l]] += U.prev_area[iTile].area[l];
+			for(l=0;l<J->mc[iTile];l++) area1[J->final_parent[J->dim_cum[iTile]+l]] += U.area[iTile].area[l];
+			if( !U.changed[iTile] )
+			{
+				for(l=0;l<mc0[iTile];l++)
+					if( U.prev_area[iTile].area[l]>0 )
+					{
+						ov[n].id0	= final_parent0[dim_cum0[iTile]+l];
+						ov[n].id1	= J->final_parent[J->dim_cum[iTile]+l];
+						ov[n++].n	= U.prev_area[iTile].area[l];
+					}
+				continue;
+			}
+			for(k=0;k<U.noverlaps[iTile];k++)
+			{
+				ov[n].id0	= final_parent0[dim_cum0[iTile]+U.overlaps[iTile][k].id0-1];
+				ov[n].id1	= J->final_parent[J->dim_cum[iTile]+U.overlaps[iTile][k].id1-1];
+				ov[n++].n	= U.overlaps[iTile][k].n;
+			}
+			free(U.overlaps[iTile]);
+			free(U.area[iTile].area);
+		}
+		// one overlap per pair of objects
+		qsort( ov, n, sizeof(overlap), cmp_overlap );
+		for(m=0,k=0;k<n;k++)
+		{
+			if( m>0 && !cmp_overlap(&ov[m-1],&ov[k]) ) ov[m-1].n += ov[k].n;
+			else ov[m++] = ov[k];
+		}
+		write_changes( changes_file, ov, m, nobj0, nobj1, area0, area1 );
+		for(iTile=0;iTile<nTiles;iTile++) free(U.prev_area[iTile].area);
+		free(U.prev_area);
+		free(U.area);
+		free(U.overlaps);
+		free(U.noverlaps);
+		free(area0);
+		free(area1);
+		free(ov);
+	}
+	free(final_parent0);
+	free(U.prev_lab_mat);
+	free(U.changed);
+	return nobj1;
+}
+
+void write_changes( char *filename, overlap *ov, size_t n, unsigned int nobj0, unsigned int nobj1, uint64_t *area0, uint64_t *area1 )
+{
+	/*
+	 *	Write the correspondence of the objects of two epochs as CSV, from their overlaps
+	 *	ov (sorted by objects, one per pair): one row {id_t0,id_t1,overlap,area_t0,area_t1,
+	 *	event} per pair of overlapping objects, then the objects of the first epoch
+	 *	overlapping none (id_t1=0) and those of the second epoch overlapping none (id_t0=0).
+	 *	Events, where partners are the overlapping objects of the other epoch:
+	 *		grown/shrunk/unchanged	one partner each, area_t1 >/</= area_t0
+	 *		merged					the object of the second epoch has more partners
+	 *		split					the object of the first epoch has more partners
+	 *		split_merged			both have more partners
+	 *		vanished/new			no partner
+	 */
+	size_t			k;
+	unsigned int	id, *deg0, *deg1;
+	const char		*event;
+	FILE			*fid;
+	deg0 = (unsigned int*)calloc(nobj0+1,sizeof(unsigned int));
+	deg1 = (unsigned int*)calloc(nobj1+1,sizeof(unsigned int));
+	for(k=0;k<n;k++) { deg0[ov[k].id0]++; deg1[ov[k].id1]++; }
+	fid = fopen(filename,"wt");
+	if (fid == NULL) { printf("Error opening file %s!\n",filename); exit(1); }
+	fprintf(fid,"id_t0,id_t1,overlap,area_t0,area_t1,event\n");
+	for(k=0;k<n;k++)
+	{
+		if		( deg0[ov[k].id0]>1 && deg1[ov[k].id1]>1 )	event = "split_merged";
+		else if	( deg0[ov[k].id0]>1 )						event = "split";
+		else if	( deg1[ov[k].id1]>1 )						event = "merged";
+		else if	( area1[ov[k].id1]>area0[ov[k].id0] )		event = "grown";
+		else if	( area1[ov[k].id1]<area0[ov[k].id0] )		event = "shrunk";
+		else												event = "unchanged";
+		fprintf(fid,"%u,%u,%llu,%llu,%llu,%s\n", ov[k].id0, ov[k].id1, (unsigned long long)ov[k].n,
+				(unsigned long long)area0[ov[k].id0], (unsigned long long)area1[ov[k].id1], event);
+	}
+	for(id=1;id<=nobj0;id++)
+		if( deg0[id]==0 ) fprintf(fid,"%u,0,0,%llu,0,vanished\n", id, (unsigned long long)area0[id]);
+	for(id=1;id<=nobj1;id++)
+		if( deg1[id]==0 ) fprintf(fid,"0,%u,0,0,%llu,new\n", id, (unsigned long long)area1[id]);
+	fclose(fid);
+	free(deg0);
+	free(deg1);
+}
+
+unsigned int filter_objects( comp_stats *s, unsigned int nobjects, unsigned int min_area, unsigned int largest, unsigned int *final_parent, unsigned int dim )
+{
+	/*
+	 *	FILTERING of the objects on their merged statistics s (s[0] is background): the
+	 *	objects smaller than min_area pixels are dropped and, with largest>0, all but the
+	 *	largest ones (at equal area, the smaller IDs are kept). The others keep their order
+	 *	and are numbered again: final_parent goes straight to the new IDs (0 if dropped), so
+	 *	that the final scan writes the filtered labels, and s is compacted. It returns the
+	 *	objects kept.
+	 */
+	unsigned int	k, kept = 0, ties = 0;
+	unsigned int	*id = (unsigned int*)calloc(nobjects+1,sizeof(unsigned int));
+	uint64_t		*area, cut = 0;		// with largest, objects above cut are kept (and ties of it)
+	if (id == NULL) { printf("Error allocating the filter!\n"); exit(1); }
+	if( largest>0 && largest<nobjects )
+	{
+		area = (uint64_t*)malloc(nobjects*sizeof(uint64_t));
+		if (area == NULL) { printf("Error allocating the filter!\n"); exit(1); }
+		for(k=0;k<nobjects;k++) area[k] = s[k+1].area;
+		qsort( area, nobjects, sizeof(uint64_t), cmp_uint64 );
+		cut		= area[nobjects-largest];
+		ties	= largest;
+		for(k=0;k<nobjects;k++) if( area[k]>cut ) ties--;
+		free(area);
+	}
+	else largest = 0;
+	for(k=1;k<=nobjects;k++)
+	{
+		if( s[k].area<min_area ) continue;
+		if( largest>0 && (s[k].area<cut || (s[k].area==cut && ties==0)) ) continue;
+		if( largest>0 && s[k].area==cut ) ties--;
+		id[k]		= ++kept;
+		s[kept]		= s[k];		// kept<=k
+	}
+	for(k=0;k<dim;k++) final_parent[k] = id[final_parent[k]];
+	free(id);
+	return kept;
+}
+
+void filter_tile_row( unsigned int ntY, void *job )
+{
+	/*
+	 *	Clear from the mask the object pixels of the ntY-th row of tiles whose final ID is
+	 *	0 (see filter_objects), reading the compact labels of the tiles before the final
+	 *	scan. A row of tiles owns whole rows of the mask, so rows run in parallel. The
+	 *	metrics and the windows then see the filtered mask.
+	 */
+	tiles_job		*J = (tiles_job*)job;
+	unsigned int	ntX, iTile, row0, col0, last_r, last_c, r, c, n, stride = J->stride;
+	unsigned int	*lab_mat, *final_id;
+	uint64_t		w, d;
+	packed_mat		tile;
+	row0	= ntY*(J->tiledimY-1);
+	last_r	= _min( J->tiledimY-1, J->NR-2-row0 );
+	for(ntX=0;ntX<J->ntilesX;ntX++)
+	{
+		iTile		= ntY*J->ntilesX + ntX;
+		lab_mat		= J->lab_mat[iTile];
+		final_id	= J->final_parent + J->dim_cum[iTile];
+		col0		= ntX*(J->tiledimX-1);
+		last_c		= _min( J->tiledimX-1, J->NC-2-col0 );
+		tile		= packed_view(J->mask, row0, col0, last_r+1, last_c+1);
+		for(r=1;r<=last_r;r++)
+			for(c=1;c<=last_c;c+=64)
+			{
+				n = _min( 64, last_c+1-c );
+				for(w=packed_word(&tile,r,c), d=0; w; w&=w-1)
+					if( final_id[ cc_pol(c+__builtin_ctzll(w),r)-1 ]==0 ) d |= w & -w;
+				if( d ) xor_bits( &tile, r, c, d, n );
+			}
+	}
+}
+
+void invert_image( packed_mat *mask, unsigned int NR, unsigned int NC )
+{
+	// background <-> objects on the image, the padding (first/last row and column) stays background
+	unsigned int r, c;
+	for(r=1;r<NR-1;r++)
+		for(c=1;c<NC-1;c+=64) xor_bits( mask, r, c, ~(uint64_t)0, _min( 64, NC-1-c ) );
+}
+
+unsigned int fill_holes( tiles_job *J, unsigned int hole_area )
+{
+	/*
+	 *	FILTERING of the holes, before the objects are labelled: the background of the
+	 *	mask is labelled by the same tiles (with the complementary connectivity, 4 for
+	 *	8-connected objects and 8 for 4-connected ones, so that holes and objects nest),
+	 *	the holes are the background components not touching the border of the image
+	 *	(their bounding box), and those smaller than hole_area pixels become object pixels.
+	 *	It returns the holes filled. The tile cache is not used for the background.
+	 */
+	unsigned int	nTiles = J->ntilesX*J->ntilesY, iTile, nbg, k, nfilled = 0;
+	unsigned int	nID = J->nID;
+	label_config	cfg = J->cfg;
+	comp_stats		**tile_st = (comp_stats**)malloc(nTiles*sizeof(comp_stats*)), **st = J->stats, *bg;
+	unsigned char	*hole;
+	if (tile_st == NULL) { printf("Error allocating the holes!\n"); exit(1); }
+	J->cfg.connectivity	= 12-cfg.connectivity;
+	J->cfg.nbytes		= 0;
+	J->cfg.scan			= pick_scan_kernel( cfg.engine, J->cfg.connectivity, 0 );
+	J->cfg.cache_dir	= NULL;
+	J->nID				= tile_nID( J->tiledimX, J->tiledimY, &J->cfg );
+	J->stats			= tile_st;
+	invert_image( J->mask, J->NR, J->NC );
+	run_tiles( J->cfg.threads, nTiles, intra_tile_labeling, J );
+	nbg	= cross_tile_equivalence( J );
+	bg	= (comp_stats*)malloc((nbg+1)*sizeof(comp_stats));
+	hole= (unsigned char*)calloc(nbg+1,1);
+	if (bg == NULL || hole == NULL) { printf("Error allocating the holes!\n"); exit(1); }
+	for(k=0;k<=nbg;k++) init_stats(&bg[k]);
+	for(iTile=0;iTile<nTiles;iTile++)
+	{
+		reduce_stats( bg, tile_st[iTile], J->mc[iTile], J->final_parent+J->dim_cum[iTile] );
+		free(tile_st[iTile]);
+	}
+	for(k=1;k<=nbg;k++)
+		if( bg[k].area<hole_area && bg[k].min_r>0 && bg[k].min_c>0 && bg[k].max_r<J->NR-3 && bg[k].max_c<J->NC-3 )
+		{
+			hole[k] = 1;
+			nfilled++;
+		}
+	// the holes are cleared from the inverted mask (final ID 0), i.e. set in the mask
+	for(k=0;k<J->dim_cum[nTiles-1]+J->mc[nTiles-1];k++) J->final_parent[k] = !hole[J->final_parent[k]];
+	run_tiles( J->cfg.threads, J->ntilesY, filter_tile_row, J );
+	invert_image( J->mask, J->NR, J->NC );
+	// the first scan writes object pixels only
+	memset( J->lab_mat[0], 0, (size_t)J->ntilesY*J->tiledimY*J->stride*sizeof(unsigned int) );
+	free(J->final_parent);
+	J->final_parent		= NULL;
+	J->stats			= st;
+	J->nID				= nID;
+	J->cfg				= cfg;
+	free(tile_st);
+	free(bg);
+	free(hole);
+	return nfilled;
+}
+
+void distance_tile_column( unsigned int ntX, void *job )
+{
+	/*
+	 *	DISTANCE TRANSFORM, first pass on the columns owned by the ntX-th column of tiles:
+	 *	the rows from every pixel to the nearest object pixel of its column (DIST_INF if
+	 *	none) and, with nearest labels, the row of that pixel. The columns are swept
+	 *	together, down and up the image, one row of the mask at a time.
+	 */
+	tiles_job		*J = (tiles_job*)job;
+	unsigned int	nr = J->NR-2, nc = J->NC-2;
+	unsigned int	c0 = ntX*(J->tiledimX-1), c1 = _min( c0+J->tiledimX-1, nc );
+	unsigned int	r, c, i, n;
+	uint32_t		*g, *near, *g1 = NULL, *near1 = NULL;	// row r and the previous one of the sweep
+	uint64_t		w;
+	for(r=0;r<nr;r++)
+	{
+		g		= J->col_dist + (size_t)r*nc;
+		near	= J->col_near ? J->col_near + (size_t)r*nc : NULL;
+		for(c=c0;c<c1;c+=64)
+		{
+			n = _min( 64, c1-c );
+			w = packed_word( J->mask, r+1, c+1 );
+			for(i=0;i<n;i++)
+			{
+				if( (w>>i)&1 )							{ g[c+i] = 0;			if( near ) near[c+i] = r; }
+				else if( r==0 || g1[c+i]==DIST_INF )	g[c+i] = DIST_INF;
+				else									{ g[c+i] = g1[c+i]+1;	if( near ) near[c+i] = near1[c+i]; }
+			}
+		}
+		g1		= g;
+		near1	= near;
+	}
+	for(r=nr-1;r-->0;)
+	{
+		g		= J->col_dist + (size_t)r*nc;
+		near	= J->col_near ? J->col_near + (size_t)r*nc : NULL;
+		for(c=c0;c<c1;c++)
+			if( g1[c]!=DIST_INF && g1[c]+1<g[c] )
+			{
+				g[c] = g1[c]+1;
+				if( near ) near[c] = near1[c];
+			}
+		g1		= g;
+		near1	= near;
+	}
+}
+
+void distance_tile_row( unsigned int ntY, void *job )
+{
+	/*
+	 *	DISTANCE TRANSFORM, second pass on the rows owned by the ntY-th row of tiles: the
+	 *	exact Euclidean distance of every pixel to the nearest object pixel is the lower
+	 *	envelope of the parabolas (c-q)^2 + g(q)^2 of the columns q of its row (Felzenszwalb
+	 *	& Huttenlocher), g from distance_tile_column. The parabolas of the envelope are v,
+	 *	the one of v[k] is the lowest from z[k] to z[k+1]. The distances (float, +inf if
+	 *	the image has no object) go to J->dist_fd and the labels of the nearest objects
+	 *	to J->near, read from the final labels of the tiles.
+	 */
+	tiles_job		*J = (tiles_job*)job;
+	unsigned int	nr = J->NR-2, nc = J->NC-2;
+	unsigned int	r0 = ntY*(J->tiledimY-1), r1 = _min( r0+J->tiledimY-1, nr );
+	unsigned int	r, c, q, k, n, nearest_r, tY, tX;
+	unsigned char	*scratch = (unsigned char*)worker_scratch( (size_t)nc*(sizeof(unsigned int)+sizeof(double)+sizeof(float)) + sizeof(double)
+															   + (size_t)(r1-r0)*nc*(J->near ? sizeof(unsigned int) : 0) );
+	double			*z		= (double*)scratch;			// nc+1
+	unsigned int	*v		= (unsigned int*)(z+nc+1);
+	float			*dist	= (float*)(v+nc);
+	unsigned int	*labels	= (unsigned int*)(dist+nc);	// rows [r0,r1) of nearest labels
+	uint32_t		*g;
+	uint64_t		d2;
+	double			s;
+	dist_header		h;
+	for(r=r0;r<r1;r++)
+	{
+		g = J->col_dist + (size_t)r*nc;
+		for(q=0,n=0;q<nc;q++)
+		{
+			if( g[q]==DIST_INF ) continue;
+			if( n>0 )
+				for(;;)
+				{	// intersection of the parabolas of v[n-1] and q: the one of v[n-1] is hidden if it is left of z[n-1]
+					s = ( ((double)g[q]*g[q] + (double)q*q) - ((double)g[v[n-1]]*g[v[n-1]] + (double)v[n-1]*v[n-1]) ) / (2.0*(q-v[n-1]));
+					if( s>z[n-1] ) break;
+					n--;
+				}
+			else s = -HUGE_VAL;
+			v[n]	= q;
+			z[n]	= s;
+			n++;
+		}
+		for(c=0,k=0;c<nc;c++)
+		{
+			if( n==0 )
+			{
+				dist[c] = HUGE_VALF;
+				if( J->near ) labels[(size_t)(r-r0)*nc+c] = 0;
+				continue;
+			}
+			while( k+1<n && z[k+1]<c ) k++;
+			d2		= (uint64_t)(c-(long)v[k])*(c-(long)v[k]) + (uint64_t)g[v[k]]*g[v[k]];
+			dist[c]	= (float)sqrt( (double)d2 );
+			if( J->near )
+			{	// pixel (nearest_r,v[k]) of the image is owned by tile (tY,tX), see write_mat
+				nearest_r	= J->col_near[(size_t)r*nc+v[k]];
+				tY			= nearest_r/(J->tiledimY-1);
+				tX			= v[k]/(J->tiledimX-1);
+				labels[(size_t)(r-r0)*nc+c] = J->lab_mat[tY*J->ntilesX+tX][ (size_t)(nearest_r-tY*(J->tiledimY-1)+1)*J->stride + v[k]-tX*(J->tiledimX-1)+1 ];
+			}
+		}
+		if( J->dist_fd>=0 && pwrite( J->dist_fd, dist, nc*sizeof(float), sizeof(h) + (off_t)r*nc*sizeof(float) )!=nc*sizeof(float) )
+		{ printf("Error writing the distances!\n"); exit(1); }
+	}
+	if( J->near ) write_labels( J->near, r0, r1-r0, labels );
+}
+
+void distance_transform( tiles_job *J, char *dist_file, char *near_file )
+{
+	/*
+	 *	DISTANCE TRANSFORM of the final mask (after -a, -l, -F) by two separable passes
+	 *	on the tiles: the columns of every column of tiles in parallel, then the rows of
+	 *	every row of tiles in parallel. It writes (either file can be NULL)
+	 *		dist_file	dist_header followed by the rows of distances, one float per pixel:
+	 *					the Euclidean distance in pixels to the nearest object pixel (0 on
+	 *					the objects)
+	 *		near_file	the label of that object, in the format of the labels (-f)
+	 *	The column pass keeps one uint32 per pixel (two with near_file).
+	 */
+	size_t			npixels = (size_t)(J->NR-2)*(J->NC-2);
+	unsigned int	ntY;
+	dist_header		h = { DIST_MAGIC, J->NR-2, J->NC-2, 32, {0,0,0,0} };
+	label_writer	near;
+	J->col_dist	= (uint32_t*)malloc(npixels*sizeof(uint32_t));
+	J->col_near	= near_file ? (uint32_t*)malloc(npixels*sizeof(uint32_t)) : NULL;
+	if (J->col_dist == NULL || (near_file && J->col_near == NULL)) { printf("Error allocating the distance transform!\n"); exit(1); }
+	J->dist_fd	= -1;
+	J->near		= NULL;
+	if( dist_file!=NULL )
+	{
+		J->dist_fd = open(dist_file,O_WRONLY|O_CREAT|O_TRUNC,0644);
+		if (J->dist_fd < 0) { printf("Error opening file %s!\n",dist_file); exit(1); }
+		if( pwrite(J->dist_fd,&h,sizeof(h),0)!=sizeof(h) ) { printf("Error writing file %s!\n",dist_file); exit(1); }
+	}
+	if( near_file!=NULL )
+	{
+		open_labels(&near, near_file, J->NR-2, J->NC-2, J->nobjects, J->tiledimY-1, J->tiff);
+		J->near = &near;
+	}
+	run_tiles( J->cfg.threads, J->ntilesX, distance_tile_column, J );
+	// OUT_TEXT is written in order
+	if( J->near && out_format==OUT_TEXT ) for(ntY=0;ntY<J->ntilesY;ntY++) distance_tile_row( ntY, J );
+	else run_tiles( J->cfg.threads, J->ntilesY, distance_tile_row, J );
+	if( J->near ) close_labels(&near);
+	if( J->dist_fd>=0 ) close(J->dist_fd);
+	free(J->col_dist);
+	free(J->col_near);
+	J->col_dist	= NULL;
+	J->col_near	= NULL;
+	J->near		= NULL;
+}
+
+void stream_labeling(
+		char			*in_file,		// I: text image, as read by read_mat
+		mapped_mat		*map,			// I: binary image mapped in memory (used instead of in_file if not NULL)
+		tiff_mat		*tiff,			// I: TIFF image (used instead of in_file if not NULL)
+		char			*out_file,		// O: labels, in out_format
+		char			*spill_file,	// provisional labels of the whole image
+		char			*stats_file,	// O: statistics of the objects (NULL: none)
+		unsigned int	tiledimX,
+		unsigned int	tiledimY,
+		unsigned int	NR,
+		unsigned int	NC,
+		unsigned int	ntilesX,
+		unsigned int	ntilesY,
+		unsigned int	nID,
+		const label_config *cfg		)
+{
+	/*
+	 *	STREAMING alternative to the in-memory pipeline of main, for images larger than RAM.
+	 *	The image is read by bands of one row of tiles (consecutive bands share one row):
+	 *
+	 *		(1) READ the band
+	 *		(2) FIRST STAGE on the tiles of the band (thread pool)
+	 *		(3) record the band in final_parent, stitching its tiles with each other (ww)
+	 *			and with the bottom labels of the previous band (nn)
+	 *		(4) SPILL the provisional keys of the band to spill_file
+	 *		(5) keep the bottom labels of the band (the band raster is reused by the next one)
+	 *
+	 *	When all bands are done final_parent is relabelled and a last pass over the spill
+	 *	file writes the output. Peak memory is one band plus final_parent, which holds one
+	 *	key per object of every tile (and its statistics, if wanted). The band has one
+	 *	more row, below the tiles, for the perimeter of the objects on their last row.
+	 */
+	unsigned int	ntX, ntY, rr, cc, k, nr, nobjects;
+	unsigned int	dim=0, dim_max=0;
+	size_t			numel;
+	label_writer	writer;
+	packed_mat		band, rows;
+	unsigned int	*labels;				// label raster of the band, tile after tile
+	unsigned int	stride = ntilesX*tiledimX;
+	unsigned int	*(lab_mat[ntilesX]);
+	unsigned int	mc[ntilesX];
+	unsigned int	dim_cum[ntilesX];
+	unsigned int	bottom_cum[ntilesX];	// dim_cum of the previous band
+	unsigned int	*bottom;				// last row of labels of the previous band
+	unsigned int	*row;					// one output row of provisional keys
+	unsigned int	*final_parent = NULL;
+	comp_stats		*(tile_stats_[ntilesX]);
+	comp_stats		*key_stats = NULL;		// statistics of every key of final_parent
+	comp_stats		*obj_stats;
+	FILE			*fin=NULL, *fspill;
+
+	if( map==NULL && tiff==NULL )
+	{
+		fin		= fopen(in_file,"rt");
+		if (fin == NULL) { printf("Error opening file %s!\n",in_file); exit(1); }
+	}
+	fspill	= fopen(spill_file,"w+b");
+	if (fspill == NULL) { printf("Error opening file %s!\n",spill_file); exit(1); }
+
+	init_packed(&band, tiledimY+1, _max( ntilesX*(tiledimX-1)+1, NC ));	// the whole tiles, see main
+	labels	= (unsigned int*)malloc((size_t)tiledimY*stride*sizeof(unsigned int));
+	bottom	= (unsigned int*)calloc(stride,sizeof(unsigned int));
+	row		= (unsigned int*)calloc(NC,sizeof(unsigned int));
+	for(ntX=0;ntX<ntilesX;ntX++) lab_mat[ntX] = labels + ntX*tiledimX;
+	tiles_job job = { .mask = &band, .map = map, .tiff = tiff, .NR = NR, .NC = NC, .tiledimX = tiledimX, .tiledimY = tiledimY,
+					  .ntilesX = ntilesX, .ntilesY = 1, .nID = nID, .lab_mat = lab_mat, .stride = stride, .mc = mc, .dim_cum = dim_cum,
+					  .stats = stats_file ? tile_stats_ : NULL, .cfg = *cfg };
+	tile_trace		traces[ntilesX];
+	double			t0 = wall_time(), t = t0;	// see trace_stage
+	if( trace_fid!=NULL ) job.trace = traces;
+
+	for(ntY=0;ntY<ntilesY;ntY++)
+	{
+		// (1)
+		if(map!=NULL) pack_map(map, &band, ntY*(tiledimY-1), NULL);
+		else if(tiff!=NULL) tiff_pack(tiff, &band, ntY*(tiledimY-1), NULL);
+		else if(ntY==0) { rows = packed_view(&band, 0, 0, band.nrows, NC); read_rows(fin, &rows, 0, NR); }
+		else
+		{	// the last two rows of the previous band are the first two of this one
+			memmove(band.words, band.words+(tiledimY-1)*band.stride, 2*band.stride*sizeof(uint64_t));
+			rows = packed_view(&band, 2, 0, tiledimY-1, NC);
+			read_rows(fin, &rows, ntY*(tiledimY-1)+2, NR);
+		}
+		job.mask_row0 = ntY*(tiledimY-1);
+		// (2)
+		memset(labels,0,(size_t)tiledimY*stride*sizeof(unsigned int));
+		run_tiles( job.cfg.threads, ntilesX, intra_tile_labeling, &job );
+		trace_tiles( &job, ntY );
+		// (3) keys of the band follow the keys of all previous bands
+		for(ntX=0;ntX<ntilesX;ntX++) { dim_cum[ntX] = dim; dim += mc[ntX]; }
+		if( dim>dim_max )
+		{
+			dim_max			= _max( dim, 2*dim_max );
+			final_parent	= (unsigned int*)realloc(final_parent,dim_max*sizeof(unsigned int));
+			if (final_parent == NULL) { printf("Error allocating final_parent!\n"); exit(1); }
+			if( stats_file!=NULL )
+			{
+				key_stats	= (comp_stats*)realloc(key_stats,dim_max*sizeof(comp_stats));
+				if (key_stats == NULL) { printf("Error allocating the statistics!\n"); exit(1); }
+			}
+		}
+		if( stats_file!=NULL )
+			for(ntX=0;ntX<ntilesX;ntX++)
+			{
+				memcpy(key_stats+dim_cum[ntX], tile_stats_[ntX], mc[ntX]*sizeof(comp_stats));
+				free(tile_stats_[ntX]);
+			}
+		for(ntX=0;ntX<ntilesX;ntX++)
+		{
+			objects_stitching_cc(dim_cum[ntX],final_parent,mc[ntX]);
+			// the bottom row of the previous band is a one-row label matrix
+			if(ntY>0) objects_stitching_nn(bottom+ntX*tiledimX,lab_mat[ntX],1,tiledimX,stride,bottom_cum[ntX],dim_cum[ntX],final_parent,&job.cfg);
+			if(ntX>0) objects_stitching_ww(lab_mat[ntX-1],lab_mat[ntX],tiledimY,tiledimX,stride,dim_cum[ntX-1],dim_cum[ntX],final_parent,&job.cfg);
+			if(ntY>0 && ntX>0)			objects_stitching_corner(bottom+(ntX-1)*tiledimX,lab_mat[ntX],0,1,tiledimX,stride,bottom_cum[ntX-1],dim_cum[ntX],final_parent,&job.cfg);
+			if(ntY>0 && ntX+1<ntilesX)	objects_stitching_corner(bottom+(ntX+1)*tiledimX,lab_mat[ntX],1,1,tiledimX,stride,bottom_cum[ntX+1],dim_cum[ntX],final_parent,&job.cfg);
+		}
+		// (4) keys are stored +1 (0 is background); overlapping rows/columns are skipped as in write_mat
+		for(rr=1;rr<tiledimY;rr++)
+		{
+			if( ntY*(tiledimY-1)+rr > NR-2 ) break;	// beyond the last row
+			k = 0;
+			for(ntX=0;ntX<ntilesX;ntX++)
+				for(cc=1;cc<tiledimX;cc++)
+				{
+					if( ntX*(tiledimX-1)+cc > NC-2 ) break;	// beyond the last column
+					row[k++] = (lab_mat[ntX][stride*rr+cc]!=0) ? dim_cum[ntX]+lab_mat[ntX][stride*rr+cc] : 0;
+				}
+			if( fwrite(row,sizeof(unsigned int),k,fspill)!=k ) { printf("Error writing file %s!\n",spill_file); exit(1); }
+		}
+		// (5)
+		memcpy(bottom, labels+(size_t)stride*(tiledimY-1), stride*sizeof(unsigned int));
+		for(ntX=0;ntX<ntilesX;ntX++) bottom_cum[ntX] = dim_cum[ntX];
+	}
+	free(labels);
+	if( fin!=NULL ) fclose(fin);
+
+	t = trace_stage( "bands", t );
+
+	// RELABEL CROSS...
+	nobjects = relabel_cross_equivalence( final_parent, dim );
+	trace_cross( &job, nobjects );
+	t = trace_stage( "cross_tile", t );
+
+	// STATISTICS of the keys go to their objects
+	if( stats_file!=NULL )
+	{
+		obj_stats = (comp_stats*)malloc((nobjects+1)*sizeof(comp_stats));
+		for(k=0;k<=nobjects;k++) init_stats(&obj_stats[k]);
+		reduce_stats( obj_stats, key_stats, dim, final_parent );
+		write_stats( stats_file, obj_stats, nobjects, NULL );
+		free(obj_stats);
+		free(key_stats);
+		t = trace_stage( "stats", t );
+	}
+
+	// FINAL SCAN over the spill file, one row of tiles at a time
+	free(row);
+	row = (unsigned int*)malloc((size_t)(tiledimY-1)*(NC-2)*sizeof(unsigned int));
+	open_labels(&writer, out_file, NR-2, NC-2, nobjects, tiledimY-1, tiff);
+	rewind(fspill);
+	for(rr=0;rr<NR-2;rr+=tiledimY-1)
+	{
+		nr		= _min( tiledimY-1, NR-2-rr );
+		numel	= (size_t)nr*(NC-2);
+		if( fread(row,sizeof(unsigned int),numel,fspill)!=numel ) { printf("Error reading file %s!\n",spill_file); exit(1); }
+		for(k=0;k<numel;k++) row[k] = (row[k]!=0) ? final_parent[row[k]-1] : 0;
+		write_labels(&writer, rr, nr, row);
+	}
+	close_labels(&writer);
+	fclose(fspill);
+	trace_stage( "final_scan", t );
+	trace_summary( &job, nobjects, t0 );
+
+	free(final_parent);
+	free(band.words);
+	free(bottom);
+	free(row);
+}
+
+/*
+ *	SHARDING: the image is labelled by gx x gy processes (the shards, e.g. on the nodes
+ *	of a cluster sharing a file system), each one on a block of whole tiles, and a merge
+ *	process joins the objects of the shards across the seams between the blocks. They
+ *	meet in shard_dir only, through files written aside and renamed (as cache_store):
+ *		shard_k.seam	from shard k to the merge (see seam_header)
+ *		shard_k.parent	from the merge to shard k (see slice_header)
+ *		run_R.abort		from a process that failed to all the others (see shard_abort)
+ *	Every file carries the run (the hash of the token of -x) and a file of another run,
+ *	left by a run that failed, is never read: the file of this run replaces it. A file
+ *	is removed by the process reading it.
+ */
+void shard_path( char *path, size_t len, char *shard_dir, unsigned int shard, char *ext )
+{
+	snprintf( path, len, "%s/shard_%u.%s", shard_dir, shard, ext );
+}
+
+uint64_t run_hash( char *token )
+{
+	// FNV-1a of the run token of -x
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for(;*token;token++) h = (h ^ (unsigned char)*token) * 0x100000001b3ULL;
+	return h;
+}
+
+void shard_abort( void )
+{
+	// atexit of the processes of a sharded run: main clears shard_abort_path when it succeeds,
+	// otherwise the file tells the others, waiting in wait_file, that the run failed
+	FILE *fid;
+	if( shard_abort_path[0]==0 ) return;
+	fid = fopen(shard_abort_path,"wb");
+	if( fid!=NULL ) fclose(fid);
+}
+
+FILE *wait_file( char *path, char *magic, uint64_t run )
 {
-	unsigned int *lm_cc;
-	unsigned int *lm_nn;
-	unsigned int *lm_ww;
-	lm_cc=lm[ntile_cc];
 	/*
-	 * For every tile, record equivalences in cross_parent in following order:
-	 *
-	 *	(1) nn [only if existent] 	---> objects_stitching_nn
-	 *	(2) ww [only if existent]	---> objects_stitching_ww
-	 *	(3) cc [always  existent]	---> objects_stitching_cc
-	 *
-	 * Point (3) records non-crossing objects and then it can build the complete and continuous
-	 * (i.e. without jumping) set of labels for the whole image.
-	 *
+	 *	Open path for reading once it is there with magic and run (polling every SHARD_POLL
+	 *	microseconds): a file of another run is waited past. It exits with an error if
+	 *	another process of the run failed (see shard_abort) or after SHARD_TIMEOUT seconds.
 	 */
-	unsigned int *cross_parent_ii,first_empty;
-	cross_parent_ii = cross_parent;
-	// here I must call the objects_stintching_XX functions!
-	// (1)
-	//		objects_stitching_nn()
-	if( ntile_nn>=0 ) {
-		lm_nn=lm[ntile_nn];
-		cross_parent=objects_stitching_nn(lm_nn,lm_cc, nr, nc,ntile_nn, ntile_cc, cross_parent);
+	struct { char magic[4]; uint32_t shard; uint64_t run; } stamp;	// the start of seam_header and slice_header
+	unsigned int	polls;
+	FILE			*fid;
+	for(polls=0;;polls++)
+	{
+		if( (fid=fopen(path,"rb"))!=NULL )
+		{
+			if( fread(&stamp,sizeof(stamp),1,fid)==1 && !memcmp(stamp.magic,magic,4) && stamp.run==run )
+			{
+				rewind(fid);
+				return fid;
+			}
+			fclose(fid);
+		}
+		else if( errno!=ENOENT ) { printf("Error opening file %s: %s\n",path,strerror(errno)); exit(1); }
+		if( shard_abort_path[0] && access(shard_abort_path,F_OK)==0 )
+		{ printf("Error: another process of the sharded run failed (%s)!\n",shard_abort_path); exit(1); }
+		if( (double)polls*SHARD_POLL >= SHARD_TIMEOUT*1e6 )
+		{
+			if( fid!=NULL )	printf("Error: %s is of another run after %u seconds!\n",path,SHARD_TIMEOUT);
+			else			printf("Error: no file %s after %u seconds!\n",path,SHARD_TIMEOUT);
+			exit(1);
+		}
+		usleep( SHARD_POLL );
 	}
-	// (2)
-	if( ntile_ww>=0 ) {
-		lm_ww=lm[ntile_ww];
-		cross_parent=objects_stitching_ww(lm_ww,lm_cc, nr, nc,ntile_ww, ntile_cc, cross_parent);
+}
+
+void shard_write( char *path, void *header, size_t hsize, uint32_t **data, size_t *n, unsigned int ndata )
+{
+	// header and ndata arrays of n[k] uint32 written aside and renamed to path
+	char			tmp[4096+32];
+	unsigned int	k;
+	FILE			*fid;
+	snprintf( tmp, sizeof(tmp), "%s.%d", path, (int)getpid() );
+	fid = fopen(tmp,"wb");
+	if (fid == NULL) { printf("Error opening file %s!\n",tmp); exit(1); }
+	if( fwrite(header,hsize,1,fid)!=1 ) { printf("Error writing file %s!\n",tmp); exit(1); }
+	for(k=0;k<ndata;k++)
+		if( fwrite(data[k],sizeof(uint32_t),n[k],fid)!=n[k] ) { printf("Error writing file %s!\n",tmp); exit(1); }
+	fclose(fid);
+	if( rename(tmp,path) ) { printf("Error renaming file %s: %s\n",tmp,strerror(errno)); exit(1); }
+}
+
+void shard_tiles( unsigned int shard, unsigned int gx, unsigned int gy, unsigned int ntilesX, unsigned int ntilesY,
+				  unsigned int *bx0, unsigned int *bx1, unsigned int *by0, unsigned int *by1 )
+{
+	// tiles [bx0,bx1) x [by0,by1) of the shard, numbered in raster order on the grid of gx x gy shards
+	*bx0 = (shard%gx)*ntilesX/gx;		*bx1 = (shard%gx+1)*ntilesX/gx;
+	*by0 = (shard/gx)*ntilesY/gy;		*by1 = (shard/gx+1)*ntilesY/gy;
+}
+
+void shard_labeling(
+		mapped_mat		*map,			// I: binary image mapped in memory (NULL if tiff)
+		tiff_mat		*tiff,			// I: TIFF image
+		char			*shard_dir,
+		uint64_t		run,			// of the token of -x (see run_hash)
+		unsigned int	shard,			// of the gx x gy shards
+		unsigned int	gx,
+		unsigned int	gy,
+		unsigned int	tiledimX,
+		unsigned int	tiledimY,
+		unsigned int	NR,
+		unsigned int	NC,
+		unsigned int	ntilesX,
+		unsigned int	ntilesY,
+		unsigned int	nID,
+		const label_config *cfg		)
+{
+	/*
+	 *	A shard labels its block of tiles as an image whose pixel (0,0) is the first one of
+	 *	the block, reading the rows of the block only: the tiles and their keys are the
+	 *	same of the whole image, so final_parent gives the objects of the shard. The seam
+	 *	file has what the merge needs of them: the compact labels of every tile, the ROOT
+	 *	of every object and, for the tiles on the border of the block, their two first and
+	 *	last rows and columns with the objects of the shard. Once the merge has written the
+	 *	global ID of every object of the shard, the final scan runs and the rows of the
+	 *	block go to their place in the out_file of the slice, once its header is found to
+	 *	be the one of the labels of this image created by the merge of the run.
+	 */
+	char			path[4096];
+	unsigned int	bx0, bx1, by0, by1, bw, bh, R0, C0, nTiles, iTile, x, y, r, c, k, nobj, nrec, nr, ncols, nbits;
+	unsigned int	*labels, **lab_mat, *mc, *dim_cum, *root, *rec, *e, *slice, *rows, stride, dim;
+	unsigned int	record = SEAM_RECORD(tiledimX,tiledimY);
+	uint32_t		*data[3];
+	size_t			n[3], nbytes;
+	packed_mat		mask, view;
+	seam_header		h;
+	slice_header	sh;
+	lab_header		lh;
+	struct stat		st;
+	FILE			*fid;
+	int				fd;
+	shard_tiles( shard, gx, gy, ntilesX, ntilesY, &bx0, &bx1, &by0, &by1 );
+	bw		= bx1-bx0;
+	bh		= by1-by0;
+	nTiles	= bw*bh;
+	R0		= by0*(tiledimY-1);
+	C0		= bx0*(tiledimX-1);
+	shard_path( path, sizeof(path), shard_dir, shard, "parent" );
+	if( unlink(path) && errno!=ENOENT ) { printf("Error removing file %s: %s\n",path,strerror(errno)); exit(1); }
+
+	// the rows of the block (and the first one of the next block) of the mask of main
+	init_packed(&mask, _min( bh*(tiledimY-1)+2, _max( ntilesY*(tiledimY-1)+1, NR ) - R0 ), _max( ntilesX*(tiledimX-1)+1, NC ));
+	if( map!=NULL )	pack_map(map, &mask, R0, NULL);
+	else			tiff_pack(tiff, &mask, R0, NULL);
+	view	= packed_view(&mask, 0, C0, mask.nrows, mask.ncols-C0);
+	stride	= bw*tiledimX;
+	labels	= (unsigned int*)calloc((size_t)bh*tiledimY*stride,sizeof(unsigned int));
+	lab_mat	= (unsigned int**)malloc(nTiles*sizeof(unsigned int*));
+	mc		= (unsigned int*)malloc(nTiles*sizeof(unsigned int));
+	dim_cum	= (unsigned int*)malloc(nTiles*sizeof(unsigned int));
+	if (labels == NULL || lab_mat == NULL || mc == NULL || dim_cum == NULL) { printf("Error allocating the labels!\n"); exit(1); }
+	for(iTile=0;iTile<nTiles;iTile++) lab_mat[iTile] = labels + (size_t)(iTile/bw)*tiledimY*stride + (iTile%bw)*tiledimX;
+	tiles_job job = { .mask = &view, .NR = NR-R0, .NC = NC-C0, .tiledimX = tiledimX, .tiledimY = tiledimY, .ntilesX = bw, .ntilesY = bh,
+					  .nID = nID, .lab_mat = lab_mat, .stride = stride, .mc = mc, .dim_cum = dim_cum, .cfg = *cfg };
+	run_tiles( job.cfg.threads, nTiles, intra_tile_labeling, &job );
+	nobj	= cross_tile_equivalence( &job );
+	dim		= dim_cum[nTiles-1]+mc[nTiles-1];
+
+	// SEAM FILE: the ROOT of every object is its first key (see relabel_cross_equivalence)
+	for(y=0,nrec=0;y<bh;y++) for(x=0;x<bw;x++) nrec += (y==0 || y==bh-1 || x==0 || x==bw-1);
+	root	= (unsigned int*)malloc(_max(nobj,1)*sizeof(unsigned int));
+	rec		= (unsigned int*)malloc((size_t)nrec*record*sizeof(unsigned int));
+	if (root == NULL || rec == NULL) { printf("Error allocating the seams!\n"); exit(1); }
+	for(k=0,r=0;k<nobj;r++) if( job.final_parent[r]==k+1 ) root[k++] = r;
+	for(iTile=0,e=rec;iTile<nTiles;iTile++)
+	{
+		y = iTile/bw;	x = iTile%bw;
+		if( y>0 && y<bh-1 && x>0 && x<bw-1 ) continue;
+		// rows {0,1} and {tiledimY-2,tiledimY-1}, columns {0,1} and {tiledimX-2,tiledimX-1}
+		for(r=0;r<tiledimY;r++)
+			for(c=0;c<tiledimX;c++)
+			{
+				k = lab_mat[iTile][(size_t)r*stride+c];
+				if( k!=0 ) k = job.final_parent[dim_cum[iTile]+k-1];
+				if( r<2 )				e[r*tiledimX+c]											= k;
+				if( r+2>=tiledimY )		e[(r+4-tiledimY)*tiledimX+c]							= k;
+				if( c<2 )				e[4*tiledimX + r*2+c]									= k;
+				if( c+2>=tiledimX )		e[4*tiledimX + 2*tiledimY + r*2+c+2-tiledimX]			= k;
+			}
+		e += record;
 	}
-	first_empty = cross_parent-cross_parent_ii;
-	// (3)
-	cross_parent=objects_stitching_cc(lm_cc,nr,nc,ntile_cc,cross_parent, cross_parent_ii, first_empty, PARENT,mc);
-	return cross_parent;
+	memset(&h,0,sizeof(seam_header));
+	memcpy(h.magic,SEAM_MAGIC,4);
+	h.shard			= shard;
+	h.run			= run;
+	h.gx			= gx;
+	h.gy			= gy;
+	h.nrows			= NR-2;
+	h.ncols			= NC-2;
+	h.tiledimX		= tiledimX;
+	h.tiledimY		= tiledimY;
+	h.connectivity	= cfg->connectivity;
+	h.partition		= cfg->partition;
+	h.nobjects		= nobj;
+	h.nrecords		= nrec;
+	data[0] = mc;	n[0] = nTiles;
+	data[1] = root;	n[1] = nobj;
+	data[2] = rec;	n[2] = (size_t)nrec*record;
+	shard_path( path, sizeof(path), shard_dir, shard, "seam" );
+	shard_write( path, &h, sizeof(seam_header), data, n, 3 );
+	free(root);
+	free(rec);
+
+	// SLICE of the merge: the global ID of every object of the shard
+	shard_path( path, sizeof(path), shard_dir, shard, "parent" );
+	fid		= wait_file( path, SLICE_MAGIC, run );
+	slice	= (unsigned int*)malloc(_max(nobj,1)*sizeof(unsigned int));
+	if (slice == NULL) { printf("Error allocating the slice!\n"); exit(1); }
+	if( fread(&sh,sizeof(slice_header),1,fid)!=1 || memcmp(sh.magic,SLICE_MAGIC,4) || sh.shard!=shard || sh.nlocal!=nobj
+		|| memchr(sh.out_file,0,sizeof(sh.out_file))==NULL
+		|| fread(slice,sizeof(unsigned int),nobj,fid)!=nobj ) { printf("Error reading file %s!\n",path); exit(1); }
+	fclose(fid);
+	unlink(path);
+	for(k=0;k<dim;k++) job.final_parent[k] = slice[job.final_parent[k]-1];
+	run_tiles( job.cfg.threads, nTiles, final_tile_labeling, &job );
+
+	// ROWS of the block at their offset in out_file (OUT_BIN, see open_labels), sized by the merge
+	nbits	= (sh.nobjects<=0xFFFF) ? 16 : 32;
+	fd		= open(sh.out_file,O_RDWR);
+	if (fd < 0) { printf("Error opening file %s!\n",sh.out_file); exit(1); }
+	if( pread(fd,&lh,sizeof(lab_header),0)!=sizeof(lab_header) || fstat(fd,&st) || memcmp(lh.magic,LAB_MAGIC,4)
+		|| lh.nrows!=NR-2 || lh.ncols!=NC-2 || lh.nbits!=nbits || lh.nobjects!=sh.nobjects || lh.nchunks!=0
+		|| (uint64_t)st.st_size!=sizeof(lab_header) + (uint64_t)(NR-2)*(NC-2)*(nbits/8) )
+	{ printf("Error: %s is not the output of the merge of this run!\n",sh.out_file); exit(1); }
+	ncols	= _min( bx1*(tiledimX-1), NC-2 ) - C0;
+	nbytes	= (size_t)ncols*nbits/8;
+	rows	= (unsigned int*)malloc((size_t)(tiledimY-1)*ncols*sizeof(unsigned int));
+	if (rows == NULL) { printf("Error allocating the rows!\n"); exit(1); }
+	for(y=0;y<bh;y++)
+	{
+		nr = tile_row_labels( &job, y, rows );
+		if( nbits==16 ) for(k=0;k<nr*ncols;k++) ((uint16_t*)rows)[k] = rows[k];
+		for(r=0;r<nr;r++)
+			if( pwrite( fd, (unsigned char*)rows + r*nbytes, nbytes,
+						sizeof(lab_header) + ((off_t)(R0+y*(tiledimY-1)+r)*(NC-2) + C0)*(nbits/8) )!=(ssize_t)nbytes )
+			{ printf("Error writing file %s!\n",sh.out_file); exit(1); }
+	}
+	close(fd);
+
+	free(rows);
+	free(slice);
+	free(job.final_parent);
+	free(labels);
+	free(lab_mat);
+	free(mc);
+	free(dim_cum);
+	free(mask.words);
 }
 
-unsigned int union_cross_equivalence(unsigned int effective_nr, unsigned int *cross_parent)
+unsigned int shard_merge( char *shard_dir, char *out_file, uint64_t run )
 {
-	unsigned int i,j,curr_r_newrule=0;
-	// I have to check whether one for loop suffices to solve the whole ROOT tree
-	for(i=0;i<effective_nr;i++)
+	/*
+	 *	The merge of the shards (see shard_labeling), which need not know the image: the
+	 *	objects of all the shards enter one final_parent and the tiles facing each other
+	 *	across the blocks are stitched by objects_stitching_nn/ww/corner on the rows and
+	 *	columns of the seam files. The objects are ordered by the key of their ROOT in the
+	 *	whole image, so that relabel_cross_equivalence numbers them as the labeling in one
+	 *	process does. out_file is created at its full size, then the slice of every shard
+	 *	is written with its absolute path, where the shard writes its rows. It returns the
+	 *	number of objects.
+	 */
+	char			path[4096];
+	seam_header		*h;
+	slice_header	sh;
+	unsigned int	gx, gy, nshards, k, ntilesX, ntilesY, tdx, tdy, bx0, bx1, by0, by1, x, y, iTile, t, record, nobjects;
+	unsigned int	*gmc, *gdim, **rec, **recs, *sx, *sy, *base, *root, *rank, *final_parent, *slice, key, total = 0;
+	uint64_t		*order;
+	uint32_t		*data[1];
+	size_t			n[1], i;
+	label_writer	W;
+	label_config	cfg;
+	FILE			*fid;
+	h = (seam_header*)malloc(sizeof(seam_header));
+	shard_path( path, sizeof(path), shard_dir, 0, "seam" );
+	fid = wait_file( path, SEAM_MAGIC, run );
+	if( fread(h,sizeof(seam_header),1,fid)!=1 || memcmp(h->magic,SEAM_MAGIC,4) ) { printf("Error reading file %s!\n",path); exit(1); }
+	fclose(fid);
+	gx			= h->gx;
+	gy			= h->gy;
+	nshards		= gx*gy;
+	tdx			= h->tiledimX;
+	tdy			= h->tiledimY;
+	ntilesX		= (h->ncols + tdx-2) / (tdx-1);
+	ntilesY		= (h->nrows + tdy-2) / (tdy-1);
+	record		= SEAM_RECORD(tdx,tdy);
+	// the stitching of the shards (see objects_stitching_nn)
+	memset( &cfg, 0, sizeof(cfg) );
+	cfg.connectivity= h->connectivity;
+	cfg.partition	= h->partition;
+	h		= (seam_header*)realloc(h,nshards*sizeof(seam_header));
+	gmc		= (unsigned int*)malloc(ntilesX*ntilesY*sizeof(unsigned int));
+	gdim	= (unsigned int*)malloc(ntilesX*ntilesY*sizeof(unsigned int));
+	rec		= (unsigned int**)calloc(ntilesX*ntilesY,sizeof(unsigned int*));
+	recs	= (unsigned int**)calloc(nshards,sizeof(unsigned int*));
+	sx		= (unsigned int*)malloc(ntilesX*sizeof(unsigned int));
+	sy		= (unsigned int*)malloc(ntilesY*sizeof(unsigned int));
+	base	= (unsigned int*)malloc((nshards+1)*sizeof(unsigned int));
+	root	= NULL;
+	if (h == NULL || gmc == NULL || gdim == NULL || rec == NULL || recs == NULL || sx == NULL || sy == NULL || base == NULL)
+	{ printf("Error allocating the merge!\n"); exit(1); }
+
+	// SEAM FILES: the objects of shard k are [base[k],base[k+1]), the records of its border
+	// tiles are indexed by their tile in the whole image
+	for(k=0;k<nshards;k++)
+	{
+		shard_path( path, sizeof(path), shard_dir, k, "seam" );
+		fid = wait_file( path, SEAM_MAGIC, run );
+		if( fread(&h[k],sizeof(seam_header),1,fid)!=1 || memcmp(h[k].magic,SEAM_MAGIC,4) || h[k].shard!=k || h[k].gx!=gx || h[k].gy!=gy
+			|| h[k].nrows!=h[0].nrows || h[k].ncols!=h[0].ncols || h[k].tiledimX!=tdx || h[k].tiledimY!=tdy
+			|| h[k].connectivity!=cfg.connectivity || h[k].partition!=cfg.partition )
+		{ printf("Error in %s: the shards are not of the same labeling!\n",path); exit(1); }
+		shard_tiles( k, gx, gy, ntilesX, ntilesY, &bx0, &bx1, &by0, &by1 );
+		for(x=bx0;x<bx1;x++) sx[x] = k%gx;
+		for(y=by0;y<by1;y++) sy[y] = k/gx;
+		base[k]	= total;
+		total	+= h[k].nobjects;
+		root	= (unsigned int*)realloc(root,_max(total,1)*sizeof(unsigned int));
+		recs[k]	= (unsigned int*)malloc(_max((size_t)h[k].nrecords*record,1)*sizeof(unsigned int));
+		if (root == NULL || recs[k] == NULL) { printf("Error allocating the merge!\n"); exit(1); }
+		for(y=by0,i=0;y<by1;y++)
+			for(x=bx0;x<bx1;x++) i += fread(&gmc[y*ntilesX+x],sizeof(unsigned int),1,fid);
+		if( i!=(bx1-bx0)*(by1-by0) || fread(root+base[k],sizeof(unsigned int),h[k].nobjects,fid)!=h[k].nobjects
+			|| fread(recs[k],sizeof(unsigned int),(size_t)h[k].nrecords*record,fid)!=(size_t)h[k].nrecords*record )
+		{ printf("Error reading file %s!\n",path); exit(1); }
+		fclose(fid);
+		for(y=by0,i=0;y<by1;y++)
+			for(x=bx0;x<bx1;x++)
+				if( y==by0 || y==by1-1 || x==bx0 || x==bx1-1 ) rec[y*ntilesX+x] = recs[k] + (i++)*record;
+	}
+	base[nshards] = total;
+	for(k=0;k<nshards;k++) { shard_path( path, sizeof(path), shard_dir, k, "seam" ); unlink(path); }
+
+	// ORDER of the objects by the key of their ROOT in the whole image (see cross_tile_equivalence)
+	for(iTile=0,key=0;iTile<ntilesX*ntilesY;iTile++) { gdim[iTile] = key; key += gmc[iTile]; }
+	order	= (uint64_t*)malloc(_max(total,1)*sizeof(uint64_t));
+	rank	= (unsigned int*)malloc(_max(total,1)*sizeof(unsigned int));
+	if (order == NULL || rank == NULL) { printf("Error allocating the merge!\n"); exit(1); }
+	for(k=0;k<nshards;k++)
 	{
-		j = 0;
-		// DO (j=j+1) Until (I will find the (first occurrence of) ROOT cross equivalence row recorded in cross_parent):
-		while(!((j>i) || ((cross_parent[j*cross_cols+0]==cross_parent[i*cross_cols+2]) && (cross_parent[j*cross_cols+1]==cross_parent[i*cross_cols+3])))) j+=1;
-		/*
-		 *	The while loop returns j=i if any previous ROOT was found!
-		 *	Hence if j<i I have to update equivalence changing current label with ROOT label.
-		 */
-		if(j<i)
+		// the local keys follow the tiles of the block in raster order, as the roots do
+		shard_tiles( k, gx, gy, ntilesX, ntilesY, &bx0, &bx1, &by0, &by1 );
+		for(i=base[k],t=0,key=0;i<base[k+1];i++)
 		{
-			cross_parent[i*cross_cols+2] = cross_parent[j*cross_cols+2];
-			cross_parent[i*cross_cols+3] = cross_parent[j*cross_cols+3];
+			for(;;t++)
+			{
+				iTile = (by0+t/(bx1-bx0))*ntilesX + bx0+t%(bx1-bx0);
+				if( root[i] < key+gmc[iTile] ) break;
+				key += gmc[iTile];
+			}
+			order[i] = ((uint64_t)(gdim[iTile]+root[i]-key)<<32) | i;
 		}
 	}
+	qsort(order, total, sizeof(uint64_t), cmp_uint64);
+	for(i=0;i<total;i++) rank[order[i]&0xFFFFFFFF] = i;
+	// the records go from the objects of the shard to their rank+1, the labels stitched
+	for(k=0;k<nshards;k++)
+		for(i=0;i<(size_t)h[k].nrecords*record;i++)
+			if( recs[k][i]!=0 ) recs[k][i] = rank[base[k]+recs[k][i]-1]+1;
 
-	int aa,x=0;
-	while(1)
-	{	x++;
-		aa=0;
-		curr_r_newrule =0;
-		for(i=0;i<effective_nr;i++)
+	// STITCHING of the tiles of different shards, on the rows/columns of the records:
+	// {0,1} and {tdy-2,tdy-1} are rows 0,1 of a tile of 2 rows, as {0,1} and {tdx-2,tdx-1}
+	final_parent = (unsigned int*)malloc(_max(total,1)*sizeof(unsigned int));
+	if (final_parent == NULL) { printf("Error allocating final_parent!\n"); exit(1); }
+	objects_stitching_cc( 0, final_parent, total );
+#define shard_of(x,y)	( sy[y]*gx + sx[x] )
+#define top2(iTile)		( rec[iTile] )
+#define bottom2(iTile)	( rec[iTile] + 2*tdx )
+#define left2(iTile)	( rec[iTile] + 4*tdx )
+#define right2(iTile)	( rec[iTile] + 4*tdx + 2*tdy )
+	for(y=0;y<ntilesY;y++)
+		for(x=0;x<ntilesX;x++)
+		{
+			iTile = y*ntilesX+x;
+			if( y>0 && sy[y]!=sy[y-1] )
+				objects_stitching_nn( bottom2(iTile-ntilesX), top2(iTile), 2, tdx, tdx, 0, 0, final_parent, &cfg );
+			if( x>0 && sx[x]!=sx[x-1] )
+				objects_stitching_ww( right2(iTile-1), left2(iTile), tdy, 2, 2, 0, 0, final_parent, &cfg );
+			if( y>0 && x>0 && shard_of(x-1,y-1)!=shard_of(x,y) )
+				objects_stitching_corner( bottom2(iTile-ntilesX-1), top2(iTile), 0, 2, tdx, tdx, 0, 0, final_parent, &cfg );
+			if( y>0 && x+1<ntilesX && shard_of(x+1,y-1)!=shard_of(x,y) )
+				objects_stitching_corner( bottom2(iTile-ntilesX+1), top2(iTile), 1, 2, tdx, tdx, 0, 0, final_parent, &cfg );
+		}
+#undef shard_of
+#undef top2
+#undef bottom2
+#undef left2
+#undef right2
+	nobjects = relabel_cross_equivalence( final_parent, total );
+
+	// OUTPUT, then the SLICES that let the shards write into it
+	out_format = OUT_BIN;
+	open_labels( &W, out_file, h[0].nrows, h[0].ncols, nobjects, tdy-1, NULL );
+	if( ftruncate( W.fd, W.data_start + (off_t)h[0].nrows*h[0].ncols*(W.nbits/8) ) )
+	{ printf("Error writing file %s: %s\n",out_file,strerror(errno)); exit(1); }
+	close_labels( &W );
+	memset(&sh,0,sizeof(slice_header));
+	if( realpath( out_file, sh.out_file )==NULL ) { printf("Error resolving the path of %s!\n",out_file); exit(1); }
+	slice = (unsigned int*)malloc(_max(total,1)*sizeof(unsigned int));
+	if (slice == NULL) { printf("Error allocating the slices!\n"); exit(1); }
+	for(i=0;i<total;i++) slice[i] = final_parent[rank[i]];
+	for(k=0;k<nshards;k++)
+	{
+		memcpy(sh.magic,SLICE_MAGIC,4);
+		sh.shard	= k;
+		sh.run		= run;
+		sh.nobjects	= nobjects;
+		sh.nlocal	= h[k].nobjects;
+		data[0]		= slice+base[k];
+		n[0]		= h[k].nobjects;
+		shard_path( path, sizeof(path), shard_dir, k, "parent" );
+		shard_write( path, &sh, sizeof(slice_header), data, n, 1 );
+	}
+
+	for(k=0;k<nshards;k++) free(recs[k]);
+	free(recs);
+	free(rec);
+	free(h);
+	free(gmc);
+	free(gdim);
+	free(sx);
+	free(sy);
+	free(base);
+	free(root);
+	free(order);
+	free(rank);
+	free(final_parent);
+	free(slice);
+	return nobjects;
+}
+
+size_t cache_size( unsigned int level )
+{
+	/*
+	 *	Bytes of the level 2/3 data cache of the first CPU, from sysconf if the C library
+	 *	knows them, else from sysfs. It returns 0 if unknown.
+	 */
+	char			path[128], type[32];
+	unsigned int	index, lev;
+	unsigned long	size = 0;
+	FILE			*fid;
+#if defined(_SC_LEVEL2_CACHE_SIZE) && defined(_SC_LEVEL3_CACHE_SIZE)
+	long			n = sysconf( (level==2) ? _SC_LEVEL2_CACHE_SIZE : _SC_LEVEL3_CACHE_SIZE );
+	if( n>0 ) return n;
+#endif
+	for(index=0;index<8 && size==0;index++)
+	{
+		snprintf( path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%u/level", index );
+		if( (fid=fopen(path,"r"))==NULL ) break;
+		if( fscanf(fid,"%u",&lev)!=1 ) lev = 0;
+		fclose(fid);
+		snprintf( path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%u/type", index );
+		if( lev!=level || (fid=fopen(path,"r"))==NULL ) continue;
+		if( fscanf(fid,"%31s",type)!=1 ) type[0] = 0;
+		fclose(fid);
+		snprintf( path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%u/size", index );
+		if( !strcmp(type,"Instruction") || (fid=fopen(path,"r"))==NULL ) continue;
+		if( fscanf(fid,"%lu%31s",&size,type)<1 ) size = 0;
+		else if( type[0]=='K' ) size <<= 10;
+		else if( type[0]=='M' ) size <<= 20;
+		fclose(fid);
+	}
+	return size;
+}
+
+void auto_tile_size( unsigned int NR1, unsigned int NC1, unsigned int bytes, unsigned int threads, unsigned int *tiledimX, unsigned int *tiledimY )
+{
+	/*
+	 *	Tile size for an image of NR1 x NC1 pixels, given the bytes per pixel of a tile
+	 *	being labelled (see main): the tile of a worker takes half of the L2 cache, and
+	 *	the tiles of all the threads workers half of L3. Tiles are about square, own a
+	 *	multiple of 64 columns (so that every tile starts at a word of the mask) and are
+	 *	no larger than the image; they are cut in rows down to 4 tiles per worker, when
+	 *	the image allows it, for the balance of the thread pool.
+	 */
+	size_t			L2 = cache_size(2), L3 = cache_size(3), npixels;
+	unsigned int	w, h;
+	if( L2==0 ) L2 = 256<<10;
+	npixels	= L2/2/bytes;
+	if( L3>0 ) npixels = _min( npixels, L3/2/bytes/threads );
+	w		= _max( (unsigned int)sqrt((double)npixels)/64, 1 )*64;
+	w		= _max( _min( w, NC1 ), 1 );				// owned columns
+	h		= _max( _min( npixels/w, NR1 ), 1 );		// owned rows
+	while( h>16 && (size_t)((NC1+w-1)/w)*((NR1+h-1)/h) < 4*threads ) h = _max( h/2, 16 );
+	*tiledimX = w+1;
+	*tiledimY = h+1;
+}
+
+unsigned int tile_nID( unsigned int tiledimX, unsigned int tiledimY, const label_config *cfg )
+{
+	// max number of provisional labels in a tile (+1 for background): one every 2x2 pixels with the
+	// 8-connected forward scan mask, every other pixel with 4-connectivity, every pixel with classes
+	return cfg->nbytes ? tiledimX*tiledimY +1
+			: (cfg->connectivity==8) ? ((tiledimX+1)/2)*((tiledimY+1)/2) +1 : (tiledimX*tiledimY+1)/2 +1;
+}
+
+int init_tiles( tiles_job *J, packed_mat *mask, unsigned int NR1, unsigned int NC1, unsigned int tiledimX, unsigned int tiledimY, const label_config *cfg )
+{
+	/*
+	 *	The tiles of an image of NR1 x NC1 pixels labelled in memory, laid out as main does
+	 *	(see there) with the configuration cfg: the label raster, the empty mask to fill and
+	 *	the arrays of the tiles. The other fields of J are cleared. It returns 0, or -1 with
+	 *	nothing allocated if out of memory.
+	 */
+	unsigned int iTile, nTiles;
+	memset(J, 0, sizeof(tiles_job));
+	J->mask		= mask;
+	J->NR		= NR1+2;
+	J->NC		= NC1+2;
+	J->tiledimX	= tiledimX;
+	J->tiledimY	= tiledimY;
+	J->ntilesX	= (NC1 + tiledimX-2) / (tiledimX-1);
+	J->ntilesY	= (NR1 + tiledimY-2) / (tiledimY-1);
+	J->cfg		= *cfg;
+	J->nID		= tile_nID( tiledimX, tiledimY, cfg );
+	J->stride	= J->ntilesX*tiledimX;
+	nTiles		= J->ntilesX*J->ntilesY;
+	if( alloc_packed( mask, _max( J->ntilesY*(tiledimY-1)+1, J->NR ), _max( J->ntilesX*(tiledimX-1)+1, J->NC ) ) ) return -1;
+	J->lab_mat	= (unsigned int**)malloc(nTiles*sizeof(unsigned int*));
+	J->mc		= (unsigned int*)malloc(nTiles*sizeof(unsigned int));
+	J->dim_cum	= (unsigned int*)malloc(nTiles*sizeof(unsigned int));
+	if( J->lab_mat!=NULL ) J->lab_mat[0] = (unsigned int*)calloc((size_t)J->ntilesY*tiledimY*J->stride,sizeof(unsigned int));
+	if( J->lab_mat==NULL || J->lab_mat[0]==NULL || J->mc==NULL || J->dim_cum==NULL )
+	{
+		if( J->lab_mat!=NULL ) free(J->lab_mat[0]);
+		free(J->lab_mat);
+		free(J->mc);
+		free(J->dim_cum);
+		free(mask->words);
+		return -1;
+	}
+	for(iTile=0;iTile<nTiles;iTile++) J->lab_mat[iTile] = J->lab_mat[0] + (size_t)(iTile/J->ntilesX)*tiledimY*J->stride + (iTile%J->ntilesX)*tiledimX;
+	return 0;
+}
+
+void free_tiles( tiles_job *J )
+{
+	free(J->lab_mat[0]);
+	free(J->lab_mat);
+	free(J->mc);
+	free(J->dim_cum);
+	free(J->final_parent);
+	free(J->mask->words);
+}
+
+double wall_time( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+uint64_t bench_hash( uint64_t x )
+{
+	/*
+	 *	splitmix64 finalizer: the synthetic masks are a pure function of the seed and of
+	 *	the pixel, the same on every machine and with any number of threads.
+	 */
+	x += 0x9E3779B97F4A7C15ULL;
+	x = (x ^ (x>>30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x>>27)) * 0x94D049BB133111EBULL;
+	return x ^ (x>>31);
+}
+
+double bench_noise( unsigned int r, unsigned int c, unsigned int cell, uint64_t seed )
+{
+	/*
+	 *	Value noise in [0,1): random values at the corners of cells of cell x cell
+	 *	pixels, smoothly interpolated inside them.
+	 */
+	uint64_t	i = r/cell, j = c/cell;
+	double		y = (double)(r%cell)/cell, x = (double)(c%cell)/cell;
+	double		v00 = (bench_hash(seed ^ ( i   <<32 | j  ))>>11) * 0x1p-53;
+	double		v01 = (bench_hash(seed ^ ( i   <<32 | (j+1)))>>11) * 0x1p-53;
+	double		v10 = (bench_hash(seed ^ ((i+1)<<32 | j  ))>>11) * 0x1p-53;
+	double		v11 = (bench_hash(seed ^ ((i+1)<<32 | (j+1)))>>11) * 0x1p-53;
+	x = x*x*(3-2*x);
+	y = y*y*(3-2*y);
+	return (v00*(1-x) + v01*x)*(1-y) + (v10*(1-x) + v11*x)*y;
+}
+
+void bench_mask( unsigned char *pixels, unsigned int NR1, unsigned int NC1, unsigned int pattern, double density, uint64_t seed )
+{
+	/*
+	 *	Synthetic mask of NR1 x NC1 pixels (1 object, 0 background, row by row):
+	 *		BENCH_UNIFORM	every pixel is object with probability density (at the
+	 *						percolation threshold the objects are the largest and most
+	 *						ragged, the hardest case of the seams)
+	 *		BENCH_SPIRAL	one object winding inwards: every turn gets labels of its
+	 *						own in every tile, joined one after the other
+	 *		BENCH_SNAKE		one comb of columns joined at the bottom and the top: the
+	 *						first scan opens a label per column and the last row of the
+	 *						tile chains them all, the worst case of the union
+	 *		BENCH_URBAN		three octaves of value noise thresholded at the quantile
+	 *						1-density: clustered blobs with ragged edges and holes, as
+	 *						settlements in a land cover map
+	 */
+	size_t			i, n = (size_t)NR1*NC1, count, *hist;
+	long			r, c, top, left, bottom, right;
+	uint16_t		*v;
+	unsigned int	t;
+	memset( pixels, 0, n );
+	switch( pattern )
+	{
+		case BENCH_UNIFORM:
+			for(i=0;i<n;i++) pixels[i] = (bench_hash(seed+i)>>11) * 0x1p-53 < density;
+			break;
+		case BENCH_SPIRAL:
+			top = 0; left = 0; bottom = (long)NR1-1; right = (long)NC1-1;
+			while( top<=bottom && left<=right )
+			{	// right, down, left and up, 1 pixel away from the previous turn
+				for(c=left;c<=right;c++)	pixels[top*NC1+c] = 1;
+				for(r=top;r<=bottom;r++)	pixels[r*NC1+right] = 1;
+				if( bottom>=top+2 )			for(c=left;c<=right;c++)	pixels[bottom*NC1+c] = 1;
+				if( right>=left+2 )			for(r=top+2;r<=bottom;r++)	pixels[r*NC1+left] = 1;
+				if( bottom>=top+2 && right>=left+2 ) pixels[(top+2)*NC1+left+1] = 1;	// into the next turn
+				top += 2; left += 2; bottom -= 2; right -= 2;
+			}
+			break;
+		case BENCH_SNAKE:
+			for(r=0;r<NR1;r++) for(c=0;c<NC1;c++)
+				pixels[r*NC1+c] = (c%2==0) || (r==NR1-1 && c%4==1) || (r==0 && c%4==3);
+			break;
+		case BENCH_URBAN:
+			v		= (uint16_t*)malloc(n*sizeof(uint16_t));
+			hist	= (size_t*)calloc(65536,sizeof(size_t));
+			if( v==NULL || hist==NULL ) { printf("Error allocating the benchmark mask!\n"); exit(1); }
+			for(r=0;r<NR1;r++) for(c=0;c<NC1;c++)
+			{
+				i		= r*NC1+c;
+				v[i]	= (uint16_t)( 65535 * ( 0.55*bench_noise(r,c,128,seed) + 0.30*bench_noise(r,c,32,seed+1) + 0.15*bench_noise(r,c,8,seed+2) ) );
+				hist[v[i]]++;
+			}
+			for(t=65535, count=hist[t]; t>0 && count+hist[t-1] <= density*n; t--) count += hist[t-1];
+			for(i=0;i<n;i++) pixels[i] = v[i]>=t;
+			free(v);
+			free(hist);
+			break;
+	}
+}
+
+void benchmark( char *bench_file, unsigned int tiledimX, unsigned int tiledimY, unsigned int NR1, unsigned int NC1 )
+{
+	/*
+	 *	BENCHMARK: the labeling of main, in memory, on synthetic masks (see bench_mask) of
+	 *	NR1/4 x NC1/4, NR1/2 x NC1/2 and NR1 x NC1 pixels, with 1, 2, 4, ... nThreads
+	 *	workers, the connectivity, engine and seam merge of the command line and the tiles
+	 *	given (or auto_tile_size for every size and number of threads). Every configuration
+	 *	runs BENCH_REPS times and the fastest time of every stage is written to bench_file,
+	 *	one CSV line per stage:
+	 *		first_scan, relabel, second_scan	cpu seconds summed over the tiles (the
+	 *							union is done on the fly by the first scan)
+	 *		intra_tile, cross_tile, third_scan, total	wall seconds
+	 *	and the throughput in Mpixel/s (per core for the cpu stages).
+	 */
+	static const struct { char *name; unsigned int pattern; double density; } runs[] = {
+		{ "uniform",		BENCH_UNIFORM,	0.2 },
+		{ "uniform",		BENCH_UNIFORM,	0.5 },
+		{ "uniform",		BENCH_UNIFORM,	0.8 },
+		{ "percolation",	BENCH_UNIFORM,	0 },	// critical density of the connectivity
+		{ "spiral",			BENCH_SPIRAL,	0 },
+		{ "snake",			BENCH_SNAKE,	0 },
+		{ "urban",			BENCH_URBAN,	0.3 },
+	};
+	static const char *stages[BENCH_STAGES] = { "first_scan", "relabel", "second_scan", "intra_tile", "cross_tile", "third_scan", "total" };
+	unsigned int	maxThreads = nThreads, scale, k, i, rep, threads, tdx, tdy, r, nr, nc, nTiles, nobjects = 0;
+	double			density, t[4], best[BENCH_STAGES], time;
+	tile_trace		*traces;
+	size_t			j, nobj;
+	unsigned char	*pixels;
+	packed_mat		mask;
+	tiles_job		job;
+	label_config	cfg = cli_config( 0 );
+	FILE			*fid;
+
+	fid = fopen(bench_file,"w");
+	if( fid==NULL ) { printf("Error opening file %s!\n",bench_file); exit(1); }
+	fprintf(fid,"pattern,density,rows,cols,tiledimX,tiledimY,threads,objects,stage,clock,seconds,mpixels_s\n");
+	for(scale=4;scale>=1;scale/=2)
+	{
+		nr		= _max( NR1/scale, 1 );
+		nc		= _max( NC1/scale, 1 );
+		pixels	= (unsigned char*)malloc((size_t)nr*nc);
+		if( pixels==NULL ) { printf("Error allocating the benchmark mask!\n"); exit(1); }
+		for(k=0;k<sizeof(runs)/sizeof(runs[0]);k++)
 		{
-			for(j = i+1;j<effective_nr;j++)
+			density = runs[k].density;
+			if( runs[k].density==0 && runs[k].pattern==BENCH_UNIFORM ) density = (connectivity==8) ? 0.407254 : 0.592746;
+			bench_mask( pixels, nr, nc, runs[k].pattern, density, 1000+k );
+			for(j=0, nobj=0;j<(size_t)nr*nc;j++) nobj += pixels[j];
+			density = (double)nobj/nr/nc;	// the actual one
+			for(threads=1;;threads=_min(2*threads,maxThreads))
 			{
-				if  (
-					((cross_parent[j*cross_cols+0]==cross_parent[i*cross_cols+0]) && (cross_parent[j*cross_cols+1]==cross_parent[i*cross_cols+1]))
-					&&
-					((cross_parent[j*cross_cols+2]!=cross_parent[i*cross_cols+2]) || (cross_parent[j*cross_cols+3]!=cross_parent[i*cross_cols+3]))
-					)
+				// TILES, as in main
+				cfg.threads	= threads;
+				tdx			= tiledimX;
+				tdy			= tiledimY;
+				if( tdx==0 || tdy==0 ) auto_tile_size( nr, nc, 4 + 4/((connectivity==8) ? 4 : 2), threads, &tdx, &tdy );
+				if( init_tiles( &job, &mask, nr, nc, tdx, tdy, &cfg ) ) { printf("Error allocating the labels!\n"); exit(1); }
+				for(r=0;r<nr;r++) pack_bytes( &mask, r+1, 1, pixels+(size_t)r*nc, nc );
+				nTiles		= job.ntilesX*job.ntilesY;
+				traces		= (tile_trace*)malloc(nTiles*sizeof(tile_trace));
+				if( traces==NULL ) { printf("Error allocating the labels!\n"); exit(1); }
+				job.trace	= traces;
+				for(i=0;i<BENCH_STAGES;i++) best[i] = HUGE_VAL;
+
+				for(rep=0;rep<BENCH_REPS;rep++)
 				{
-/*
-					printf("Found [j] %d %d %d %d \t<--> [i] %d %d %d %d\n",
-							cross_parent[j*cross_cols+0],cross_parent[j*cross_cols+1],cross_parent[j*cross_cols+2],cross_parent[j*cross_cols+3],
-							cross_parent[i*cross_cols+0],cross_parent[i*cross_cols+1],cross_parent[i*cross_cols+2],cross_parent[i*cross_cols+3]
-					);
-*/
-					aa=1;
-					if( (cross_parent[j*cross_cols+2]>cross_parent[i*cross_cols+2]) ||
-						((cross_parent[j*cross_cols+2]==cross_parent[i*cross_cols+2]) && ( cross_parent[j*cross_cols+3]>cross_parent[i*cross_cols+3]))	)
+					memset( job.lab_mat[0], 0, (size_t)job.ntilesY*tdy*job.stride*sizeof(unsigned int) );
+					free(job.final_parent);
+					job.final_parent = NULL;
+					t[0] = wall_time();
+					run_tiles( job.cfg.threads, nTiles, intra_tile_labeling, &job );
+					t[1] = wall_time();
+					nobjects = cross_tile_equivalence( &job );
+					t[2] = wall_time();
+					run_tiles( job.cfg.threads, nTiles, final_tile_labeling, &job );
+					t[3] = wall_time();
+					for(i=0;i<3;i++)
 					{
-						cross_parent[(effective_nr+curr_r_newrule)*cross_cols+0]=cross_parent[j*cross_cols+2];
-						cross_parent[(effective_nr+curr_r_newrule)*cross_cols+1]=cross_parent[j*cross_cols+3];
-						cross_parent[(effective_nr+curr_r_newrule)*cross_cols+2]=cross_parent[i*cross_cols+2];
-						cross_parent[(effective_nr+curr_r_newrule)*cross_cols+3]=cross_parent[i*cross_cols+3];
-						cross_parent[j*cross_cols+2] = cross_parent[i*cross_cols+2];
-						cross_parent[j*cross_cols+3] = cross_parent[i*cross_cols+3];
+						for(j=0, time=0;j<nTiles;j++) time += (i==0) ? traces[j].first_scan : (i==1) ? traces[j].relabel : traces[j].second_scan;
+						best[i] = _min( best[i], time );
+						best[3+i] = _min( best[3+i], t[i+1]-t[i] );
 					}
-					else
-					{
-						cross_parent[(effective_nr+curr_r_newrule)*cross_cols+0]=cross_parent[i*cross_cols+2];
-						cross_parent[(effective_nr+curr_r_newrule)*cross_cols+1]=cross_parent[i*cross_cols+3];
-						cross_parent[(effective_nr+curr_r_newrule)*cross_cols+2]=cross_parent[j*cross_cols+2];
-						cross_parent[(effective_nr+curr_r_newrule)*cross_cols+3]=cross_parent[j*cross_cols+3];
-						cross_parent[i*cross_cols+2] = cross_parent[j*cross_cols+2];
-						cross_parent[i*cross_cols+3] = cross_parent[j*cross_cols+3];
-					}
-					curr_r_newrule += 1;
+					best[6] = _min( best[6], t[3]-t[0] );
 				}
+				for(i=0;i<BENCH_STAGES;i++)
+					fprintf(fid,"%s,%.4f,%u,%u,%u,%u,%u,%u,%s,%s,%.6f,%.2f\n", runs[k].name, density, nr, nc, tdx, tdy, threads, nobjects,
+							stages[i], (i<3) ? "cpu" : "wall", best[i], (double)nr*nc/1e6/_max(best[i],1e-9));
+
+				free_tiles(&job);
+				free(traces);
+				if( threads==maxThreads ) break;
 			}
 		}
-		effective_nr += curr_r_newrule;
-		if (aa==0) break;
+		free(pixels);
 	}
-	return effective_nr;
+	fclose(fid);
 }
 
-unsigned int *relabel_cross_equivalence( unsigned int *final_parent, unsigned int *cross_parent,unsigned int dim_cross,unsigned int nTiles,unsigned int *mc)
+unsigned int bfs_labels( uint16_t *pixels, unsigned int NR1, unsigned int NC1, unsigned int *labels )
 {
-	unsigned int i,j,k,iTile,final_count=1;
-	// It reuses the 4th column writing the overall image IDs
-	for(i=0;i<dim_cross;i++)
+	/*
+	 *	Reference labeling, a flood fill independent of the tiles: every object pixel
+	 *	(pixels!=Vb, row by row) not labelled yet starts a new object, grown by a FIFO
+	 *	through the neighbours of the same value (8 or 4 as connectivity). It returns the
+	 *	number of objects.
+	 */
+	size_t			n = (size_t)NR1*NC1, i, head, tail, *queue;
+	unsigned int	nobjects = 0, r, c, k;
+	int				dr, dc;
+	queue = (size_t*)malloc(_max(n,1)*sizeof(size_t));
+	if( queue==NULL ) { printf("Error allocating the flood fill!\n"); exit(1); }
+	memset( labels, 0, n*sizeof(unsigned int) );
+	for(i=0;i<n;i++)
 	{
-		if( (cross_parent[i*cross_cols+0]==cross_parent[i*cross_cols+2]) && (cross_parent[i*cross_cols+1]==cross_parent[i*cross_cols+3]) )
-		{
-			cross_parent[i*cross_cols+3] = final_count++;
-		}
-		else
+		if( pixels[i]==Vb || labels[i] ) continue;
+		labels[i]	= ++nobjects;
+		queue[0]	= i;
+		for(head=0, tail=1; head<tail; head++)
 		{
-			j = 0;
-			while(!((j>i) || ((cross_parent[j*cross_cols+0]==cross_parent[i*cross_cols+2]) && (cross_parent[j*cross_cols+1]==cross_parent[i*cross_cols+3])))) j+=1;
-			if (j<=i) cross_parent[i*cross_cols+3]=cross_parent[j*cross_cols+3];
-			else puts("Error in cross_parent!\nCheck one of {union_cross_equivalence, record_cross_equivalence}");
+			r = queue[head]/NC1;
+			c = queue[head]%NC1;
+			for(dr=-1;dr<=1;dr++) for(dc=-1;dc<=1;dc++)
+			{
+				if( (dr==0 && dc==0) || (connectivity==4 && dr!=0 && dc!=0) ) continue;
+				if( (int)r+dr<0 || r+dr>=NR1 || (int)c+dc<0 || c+dc>=NC1 ) continue;
+				k = (r+dr)*NC1 + c+dc;
+				if( pixels[k]!=pixels[i] || labels[k] ) continue;
+				labels[k]		= nobjects;
+				queue[tail++]	= k;
+			}
 		}
 	}
-	//costruzione di final_parente: semplificato la cross eliminando i doppioni considerando solo le prime due colonne.
-	//printf("cross_parent -- nicolazzo abrupt code\n");
-	k=0;
-	for(iTile = 0;iTile<nTiles;iTile++)
+	free(queue);
+	return nobjects;
+}
+
+unsigned int same_partition( unsigned int *a, unsigned int *b, size_t n, unsigned int na, unsigned int nb )
+{
+	/*
+	 *	1 if the labels a (1..na) and b (1..nb) of n pixels make the same objects, whatever
+	 *	their numbering: the same background and a one-to-one map between the labels.
+	 */
+	unsigned int	*ab, *ba, same = (na==nb);
+	size_t			i;
+	ab = (unsigned int*)calloc((size_t)na+1,sizeof(unsigned int));
+	ba = (unsigned int*)calloc((size_t)nb+1,sizeof(unsigned int));
+	if( ab==NULL || ba==NULL ) { printf("Error allocating the partition check!\n"); exit(1); }
+	for(i=0;i<n && same;i++)
+	{
+		if( (a[i]==0) != (b[i]==0) || a[i]>na || b[i]>nb )	same = 0;
+		else if( a[i]==0 )									continue;
+		else if( ab[a[i]]==0 && ba[b[i]]==0 )				{ ab[a[i]] = b[i]; ba[b[i]] = a[i]; }
+		else if( ab[a[i]]!=b[i] || ba[b[i]]!=a[i] )			same = 0;
+	}
+	free(ab);
+	free(ba);
+	return same;
+}
+
+unsigned int verify( unsigned int rounds )
+{
+	/*
+	 *	VERIFICATION, the oracle of every engine: rounds random masks (size up to 200 x 200,
+	 *	uniform at a random density, the patterns of bench_mask or up to 4 classes in
+	 *	patches) are cut in random tiles and labelled in memory with 8- and 4-connectivity,
+	 *	pixels and runs engines (pixels only for classes, 8 or 16 bits), tile by tile and
+	 *	hierarchical seams, overlapping tiles and -P (not for classes), 1 and 4 threads. The labels must be the partition of bfs_labels
+	 *	(see same_partition), and nobjects its count. Every case that fails is printed with
+	 *	its parameters, and the number of failures returned. All is a function of the
+	 *	round: a failure is reproduced by the same rounds.
+	 */
+	static const unsigned char conns[2] = { 8, 4 }, engines[2] = { SCAN_PIXELS, SCAN_RUNS }, threads[2] = { 1, 4 };
+	unsigned int	round, nr, nc, tdx, tdy, pattern, nbytes, r, c, ic, ie, ih, ip, it, ntY, nref, nobjects;
+	unsigned int	ncases = 0, nfailed = 0, *ref, *lab;
+	unsigned char	*bytes;
+	uint16_t		*pixels;
+	uint64_t		h;
+	double			density;
+	size_t			i, n;
+	packed_mat		mask, image;
+	class_mat		classes;
+	tiles_job		job;
+	label_config	cfg;
+	for(round=0;round<rounds;round++)
 	{
-		for (j=1;j<=mc[iTile];j++)
+		h		= bench_hash( round );
+		nr		= 1 + h%200;
+		nc		= 1 + (h>>8)%200;
+		tdx		= 2 + (h>>16)%64;
+		tdy		= 2 + (h>>24)%64;
+		pattern	= (h>>32)%5;				// BENCH_* or classes
+		nbytes	= 1 + (h>>40)%2;
+		density	= ((h>>44)%1000) / 1000.0;
+		n		= (size_t)nr*nc;
+		bytes	= (unsigned char*)malloc(n);
+		pixels	= (uint16_t*)malloc(n*sizeof(uint16_t));
+		ref		= (unsigned int*)malloc(n*sizeof(unsigned int));
+		lab		= (unsigned int*)malloc(n*sizeof(unsigned int));
+		if( bytes==NULL || pixels==NULL || ref==NULL || lab==NULL ) { printf("Error allocating the verification!\n"); exit(1); }
+		if( pattern<=BENCH_URBAN ) bench_mask( bytes, nr, nc, pattern, density, h );
+		for(i=0;i<n;i++)
+		{	// classes: one of 4 per 8x8 patch, or a random one (1/4 of background)
+			if( pattern<=BENCH_URBAN )				pixels[i] = bytes[i];
+			else if( bench_hash(h+i)%4 )			pixels[i] = bench_hash( h ^ ((i/nc/8)<<32 | (i%nc/8)) ) % 4;
+			else									pixels[i] = bench_hash(h-i) % 4;
+			if( pattern>BENCH_URBAN && nbytes==2 )	pixels[i] *= 1000;
+		}
+		multi_class = (pattern>BENCH_URBAN);
+		for(ic=0;ic<2;ic++)
 		{
-			for (i=0;i<dim_cross;i++)
+			connectivity	= conns[ic];
+			nref			= bfs_labels( pixels, nr, nc, ref );
+			for(ie=0;ie<2;ie++) for(ih=0;ih<2;ih++) for(ip=0;ip<2;ip++) for(it=0;it<2;it++)
 			{
-				if ((cross_parent[i*cross_cols+0]==iTile) && (cross_parent[i*cross_cols+1]==j)) break;
+				if( multi_class && (engines[ie]==SCAN_RUNS || ip) ) continue;
+				scan_engine			= engines[ie];
+				hierarchical		= ih;
+				partition			= ip;
+				nThreads			= threads[it];
+				cfg					= cli_config( nbytes );
+				if( init_tiles( &job, &mask, nr, nc, tdx, tdy, &cfg ) ) { printf("Error allocating the labels!\n"); exit(1); }
+				if( multi_class )
+				{
+					init_classes( &classes, job.NR, job.NC, nbytes );
+					for(r=0;r<nr;r++) for(c=0;c<nc;c++)
+						if( nbytes==1 )	((uint8_t*)class_ptr(&classes,r+1,c+1))[0]		= pixels[(size_t)r*nc+c];
+						else			((uint16_t*)class_ptr(&classes,r+1,c+1))[0]	= pixels[(size_t)r*nc+c];
+					image = packed_view( &mask, 0, 0, job.NR, job.NC );	// as wide as the classes
+					for(r=0;r<nr;r++) pack_classes( &image, r+1, &classes, r+1 );
+					job.classes = &classes;
+				}
+				else for(r=0;r<nr;r++) pack_bytes( &mask, r+1, 1, bytes+(size_t)r*nc, nc );
+				run_tiles( job.cfg.threads, job.ntilesX*job.ntilesY, intra_tile_labeling, &job );
+				nobjects = cross_tile_equivalence( &job );
+				run_tiles( job.cfg.threads, job.ntilesX*job.ntilesY, final_tile_labeling, &job );
+				for(ntY=0, i=0;ntY<job.ntilesY;ntY++) i += (size_t)tile_row_labels( &job, ntY, lab+i )*nc;
+				ncases++;
+				if( nobjects!=nref || !same_partition( ref, lab, n, nref, nobjects ) )
+				{
+					nfailed++;
+					printf("FAILED round %u: %ux%u pixels, tiles %ux%u%s, pattern %u, %u-connected, %s engine, %s seams, %u threads: %u objects instead of %u\n",
+							round, nr, nc, tdx, tdy, partition ? " (-P)" : "", pattern, connectivity, scan_engine==SCAN_RUNS ? "runs" : "pixels",
+							hierarchical ? "hierarchical" : "raster", nThreads, nobjects, nref);
+				}
+				if( multi_class ) free(classes.data);
+				free_tiles(&job);
 			}
-			final_parent[k++]=cross_parent[i*cross_cols+3];
-			//printf("%d %d %d\n",iTile,j,cross_parent[i*cross_cols+3]);
 		}
+		free(bytes);
+		free(pixels);
+		free(ref);
+		free(lab);
 	}
-	return final_parent;
+	printf("%u cases, %u failed\n",ncases,nfailed);
+	return nfailed;
 }
 
+double trace_stage( const char *stage, double t0 )
+{
+	/*
+	 *	Instrumentation (-J): one JSON line with the wall seconds of stage, started at t0.
+	 *	It returns the start of the next stage (0 if not traced), so that the stages of
+	 *	main are chained as t = trace_stage("...", t).
+	 */
+	double t;
+	if( trace_fid==NULL ) return 0;
+	t = wall_time();
+	fprintf(trace_fid,"{\"event\":\"stage\",\"stage\":\"%s\",\"seconds\":%.6f}\n",stage,t-t0);
+	return wall_time();
+}
 
-unsigned int *third_scan(
-				unsigned int	nrows,
-				unsigned int	ncols,
-				unsigned int	*lab_mat,
-				unsigned int	*cur_final_parent	)
+void trace_tiles( tiles_job *J, unsigned int ntY0 )
 {
-	unsigned int r;
-	unsigned int c;
-	for(r=0; r<nrows; r++)
-		for(c=0; c<ncols; c++)
-			if(cc_pol(c,r)!=0) // if (r,c) is object pixel
-			{	//printf("%d<-%d\n",cc_pol(c,r), cur_final_parent[cc_pol(c,r)-1]);
-				cc_pol(c,r) = cur_final_parent[cc_pol(c,r)-1];
-			}
-	return lab_mat;
+	/*
+	 *	One JSON line per tile of J (the first row of tiles is ntY0 of the image): the
+	 *	wall seconds of the first stage (the union is on the fly in the first scan), the
+	 *	provisional labels of the first scan and how much of nID (the size of PARENT) they
+	 *	fill, the compact labels and the provisional ones merged into them.
+	 */
+	unsigned int	iTile;
+	tile_trace		*tr;
+	if( trace_fid==NULL || J->trace==NULL ) return;
+	for(iTile=0;iTile<J->ntilesX*J->ntilesY;iTile++)
+	{
+		tr = &J->trace[iTile];
+		fprintf(trace_fid,"{\"event\":\"tile\",\"tile\":%u,\"row\":%u,\"col\":%u,\"first_scan\":%.6f,\"relabel\":%.6f,\"second_scan\":%.6f,"
+				"\"provisional\":%u,\"nID\":%u,\"fill\":%.4f,\"labels\":%u,\"merged\":%u,\"cached\":%u}\n",
+				(ntY0+iTile/J->ntilesX)*J->ntilesX + iTile%J->ntilesX, ntY0+iTile/J->ntilesX, iTile%J->ntilesX,
+				tr->first_scan, tr->relabel, tr->second_scan, tr->provisional, J->nID, (double)tr->provisional/J->nID,
+				J->mc[iTile], tr->cached ? 0 : tr->provisional-J->mc[iTile], tr->cached);
+	}
+}
+
+void trace_cross( tiles_job *J, unsigned int nobjects )
+{
+	/*
+	 *	One JSON line on the second stage: the keys of final_parent (the compact labels of
+	 *	all tiles), the objects they make, the keys merged across the seams and the levels
+	 *	of blocks of the hierarchical merge (0 tile by tile).
+	 */
+	unsigned int	last = J->ntilesX*J->ntilesY-1, keys = J->dim_cum[last]+J->mc[last], levels = 0, b;
+	if( trace_fid==NULL ) return;
+	for(b=J->block;b>1;b/=2) levels++;
+	fprintf(trace_fid,"{\"event\":\"cross\",\"keys\":%u,\"objects\":%u,\"merged\":%u,\"levels\":%u,\"final_parent_bytes\":%zu}\n",
+			keys, nobjects, keys-nobjects, levels, (size_t)keys*sizeof(unsigned int));
+}
+
+void trace_summary( tiles_job *J, unsigned int nobjects, double t0 )
+{
+	// last JSON line: the run, its wall seconds since t0 and the peak resident memory
+	struct rusage	ru;
+	if( trace_fid==NULL ) return;
+	getrusage( RUSAGE_SELF, &ru );
+	fprintf(trace_fid,"{\"event\":\"summary\",\"rows\":%u,\"cols\":%u,\"tiledimX\":%u,\"tiledimY\":%u,\"tiles\":%u,\"threads\":%u,"
+			"\"connectivity\":%u,\"engine\":\"%s\",\"objects\":%u,\"seconds\":%.6f,\"peak_rss_kb\":%ld}\n",
+			J->NR-2, J->NC-2, J->tiledimX, J->tiledimY, J->ntilesX*((J->NR-2 + J->tiledimY-2)/(J->tiledimY-1)), J->cfg.threads,
+			J->cfg.connectivity, J->cfg.engine==SCAN_RUNS ? "runs" : "pixels", nobjects, wall_time()-t0, ru.ru_maxrss);
+}
+
+void library_tile_labeling( unsigned int iTile, void *job )
+{
+	// third scan of the tile and copy of the pixels it owns to the labels of ccl_label
+	tiles_job *J = (tiles_job*)job;
+	unsigned int row0	= (iTile/J->ntilesX)*(J->tiledimY-1), col0 = (iTile%J->ntilesX)*(J->tiledimX-1);
+	unsigned int last_r	= _min( J->tiledimY-1, J->NR-2-row0 );
+	unsigned int last_c	= _min( J->tiledimX-1, J->NC-2-col0 );
+	unsigned int rr;
+	final_tile_labeling( iTile, job );
+	for(rr=1;rr<=last_r;rr++)
+		memcpy( J->out + (size_t)(row0+rr-1)*J->out_stride + col0, J->lab_mat[iTile] + (size_t)rr*J->stride + 1, last_c*sizeof(uint32_t) );
+}
+
+void ccl_reset( ccl_context *ctx )
+{
+	// back to a context with no mask: its tiles, forest and arenas are freed
+	unsigned int k;
+	if( ctx->rows ) free_tiles(&ctx->job);
+	if( ctx->scratch!=NULL ) for(k=0;k<ctx->opt.threads;k++) free(ctx->scratch[k]);
+	free(ctx->scratch);
+	memset( &ctx->job, 0, sizeof(tiles_job) );
+	ctx->scratch	= NULL;
+	ctx->keys		= 0;
+	ctx->rows		= 0;
+	ctx->cols		= 0;
+}
+
+ccl_context *ccl_create( const ccl_options *options )
+{
+	ccl_options		def = CCL_DEFAULT_OPTIONS;
+	ccl_context		*ctx;
+	if( options==NULL ) options = &def;
+	if( (options->connectivity!=8 && options->connectivity!=4) || options->engine>CCL_RUNS
+		|| options->tiledimX==1 || options->tiledimY==1 ) return NULL;
+	ctx = (ccl_context*)calloc(1,sizeof(ccl_context));
+	if( ctx==NULL ) return NULL;
+	ctx->opt			= *options;
+	ctx->opt.threads	= _max( ctx->opt.threads, 1 );
+	return ctx;
+}
+
+int ccl_label( ccl_context *ctx, const uint8_t *mask, unsigned int rows, unsigned int cols, size_t stride,
+			   uint32_t *labels, size_t labels_stride, unsigned int *nobjects )
+{
+	/*
+	 *	LIBRARY: the in-memory pipeline of main on a mask in memory, without files. The
+	 *	configuration of the labeling comes from the options of ctx and travels in its
+	 *	tiles_job (no global is written), so that different contexts label at the same
+	 *	time. The tiles (mask, label raster), the arenas of the first stage (one per thread)
+	 *	and final_parent of ctx are reused if the size did not change, so that the pipeline
+	 *	allocates nothing but the stacks of its worker threads. Out of memory, or a thread
+	 *	that cannot start, gives -1 and a context with no mask (never exit, see run_tiles).
+	 */
+	tiles_job		*J;
+	label_config	cfg;
+	unsigned int	tdx, tdy, r, k, nTiles, n, dim;
+	unsigned int	*forest;
+	if( ctx==NULL || mask==NULL || labels==NULL || rows==0 || cols==0 || stride<cols || labels_stride<cols ) return -1;
+	J = &ctx->job;
+	cfg.threads			= ctx->opt.threads;
+	cfg.connectivity	= ctx->opt.connectivity;
+	cfg.partition		= ctx->opt.partition;
+	cfg.hierarchical	= ctx->opt.hierarchical;
+	cfg.engine			= ctx->opt.engine;
+	cfg.nbytes			= 0;
+	cfg.scan			= pick_scan_kernel( cfg.engine, cfg.connectivity, 0 );
+	cfg.cache_dir		= NULL;
+	tdx					= ctx->opt.tiledimX;
+	tdy					= ctx->opt.tiledimY;
+	if( tdx==0 || tdy==0 ) auto_tile_size( rows, cols, 4 + 4/((cfg.connectivity==8) ? 4 : 2), cfg.threads, &tdx, &tdy );
+	if( ctx->rows!=rows || ctx->cols!=cols || J->tiledimX!=tdx || J->tiledimY!=tdy )
+	{	// tiles of a new size
+		ccl_reset( ctx );
+		if( init_tiles( J, &ctx->mask, rows, cols, tdx, tdy, &cfg ) ) return -1;
+		ctx->rows		= rows;
+		ctx->cols		= cols;
+		ctx->scratch	= (unsigned char**)calloc(cfg.threads,sizeof(unsigned char*));
+		if( ctx->scratch==NULL ) { ccl_reset( ctx ); return -1; }
+		for(k=0;k<cfg.threads;k++)
+		{
+			ctx->scratch[k] = (unsigned char*)malloc((J->nID + 3*tdx+6)*sizeof(unsigned int));
+			if( ctx->scratch[k]==NULL ) { ccl_reset( ctx ); return -1; }
+		}
+	}
+	else
+	{
+		memset( ctx->mask.words, 0, ctx->mask.stride*ctx->mask.nrows*sizeof(uint64_t) );
+		memset( J->lab_mat[0], 0, (size_t)J->ntilesY*tdy*J->stride*sizeof(unsigned int) );
+	}
+	nTiles			= J->ntilesX*J->ntilesY;
+	J->scratch		= ctx->scratch;
+	J->thread_error	= 0;
+	for(r=0;r<rows;r++) pack_bytes( &ctx->mask, r+1, 1, (unsigned char*)mask + r*stride, cols );
+	if( run_tiles( J->cfg.threads, nTiles, intra_tile_labeling, J ) ) { ccl_reset( ctx ); return -1; }
+	for(dim=1,k=0;k<nTiles;k++) dim += J->mc[k];
+	if( dim>ctx->keys )
+	{	// final_parent grows with the keys of the mask (see cross_tile_equivalence)
+		forest = (unsigned int*)realloc(J->final_parent,dim*sizeof(unsigned int));
+		if( forest==NULL ) { ccl_reset( ctx ); return -1; }
+		J->final_parent	= forest;
+		ctx->keys		= dim;
+	}
+	n = cross_tile_equivalence( J );
+	J->out			= labels;
+	J->out_stride	= labels_stride;
+	if( J->thread_error || run_tiles( J->cfg.threads, nTiles, library_tile_labeling, J ) ) { ccl_reset( ctx ); return -1; }
+	if( nobjects!=NULL ) *nobjects = n;
+	return 0;
 }
 
+void ccl_destroy( ccl_context *ctx )
+{
+	if( ctx==NULL ) return;
+	ccl_reset( ctx );
+	free(ctx);
+}
 
+void print_usage( char *prog )
+{
+	printf("Usage: %s [-i in_file] [-o out_file] [-f text|bin|zbin|tiff|ztiff] [-t nThreads] [-H] [-S spill_file] [-e pixels|runs] [-s stats_file] [-m metrics_file] [-w window_file -k size[:step]] [-u update_file [-c changes_file]] [-C cache_dir] [-n 4|8] [-M] [-P] [-a min_area] [-l largest] [-F hole_area] [-d dist_file] [-N near_file] [-B bench_file] [-J trace_file] [-Z shard_dir -x shard:gx:gy:run] tiledimX tiledimY [NC NR]\n       %s -Z shard_dir -x merge:run [-o out_file] [-J trace_file]\n       %s -V rounds\n",prog,prog,prog);
+}
 
+#ifndef CCL_LIBRARY
 int main(int argc, char **argv)
 {
-	unsigned int tiledimX 	= atoi( argv[1] );
-	unsigned int tiledimY 	= atoi( argv[2] );
-	unsigned int NC1 		= atoi( argv[3] );//98; // passed by JAI
-	unsigned int NR1 		= atoi( argv[4] );//98; // passed by JAI
+	int opt;
+	char *in_file		= "/home/giuliano/git/soil-sealing/data/ALL.txt";
+	char *out_file		= "/home/giuliano/git/soil-sealing/data/Ccode.txt";
+	char *spill_file	= NULL;
+	char *stats_file	= NULL;
+	char *metrics_file	= NULL;
+	char *window_file	= NULL;
+	char *update_file	= NULL;
+	char *changes_file	= NULL;
+	char *bench_file	= NULL;
+	char *trace_file	= NULL;
+	char *dist_file		= NULL;
+	char *near_file		= NULL;
+	char *shard_dir		= NULL;
+	char *shard_arg		= NULL;		// -x: shard:gx:gy:run or merge:run (see shard_labeling)
+	unsigned int shard=0, gx=0, gy=0;
+	int run_at=0;					// of the run token in shard_arg
+	uint64_t run=0;
+	unsigned int verify_rounds = 0;
+	unsigned int win_size=0, win_step=0;
+	unsigned int min_area=0, largest=0, hole_area=0;	// filters (see filter_objects, fill_holes)
+	mapped_mat map, map1;
+	tiff_mat tif, tif1;
+	unsigned int binary, tiff, binary1, tiff1;
+	while( (opt=getopt(argc,argv,"i:o:f:t:HS:e:s:m:w:k:u:c:C:n:MPa:l:F:d:N:B:V:J:Z:x:"))!=-1 )
+	{
+		switch(opt)
+		{
+			case 'i':	in_file = optarg;					break;
+			case 'o':	out_file = optarg;					break;
+			case 'f':
+				if		( !strcmp(optarg,"text") )	out_format = OUT_TEXT;
+				else if	( !strcmp(optarg,"bin") )	out_format = OUT_BIN;
+				else if	( !strcmp(optarg,"zbin") )	out_format = OUT_ZBIN;
+				else if	( !strcmp(optarg,"tiff") )	out_format = OUT_TIFF;
+				else if	( !strcmp(optarg,"ztiff") )	out_format = OUT_ZTIFF;
+				else { print_usage(argv[0]); exit(1); }
+				break;
+			case 't':	nThreads = _max( atoi(optarg), 1 );	break;
+			case 'H':	hierarchical = 1;					break;
+			case 'S':	spill_file = optarg;				break;
+			case 's':	stats_file = optarg;				break;
+			case 'm':	metrics_file = optarg;				break;
+			case 'w':	window_file = optarg;				break;
+			case 'u':	update_file = optarg;				break;
+			case 'c':	changes_file = optarg;				break;
+			case 'C':	cache_dir = optarg;					break;
+			case 'M':	multi_class = 1;					break;
+			case 'P':	partition = 1;						break;
+			case 'a':	min_area = atoi(optarg);			break;
+			case 'l':	largest = atoi(optarg);				break;
+			case 'F':	hole_area = atoi(optarg);			break;
+			case 'd':	dist_file = optarg;					break;
+			case 'N':	near_file = optarg;					break;
+			case 'B':	bench_file = optarg;				break;
+			case 'J':	trace_file = optarg;				break;
+			case 'Z':	shard_dir = optarg;					break;
+			case 'x':	shard_arg = optarg;					break;
+			case 'V':
+				verify_rounds = atoi(optarg);
+				if( verify_rounds==0 ) { print_usage(argv[0]); exit(1); }
+				break;
+			case 'n':
+				connectivity = atoi(optarg);
+				if( connectivity!=8 && connectivity!=4 ) { print_usage(argv[0]); exit(1); }
+				break;
+			case 'k':
+				if( sscanf(optarg,"%u:%u",&win_size,&win_step)<2 ) win_step = win_size;
+				if( win_size==0 || win_step==0 ) { print_usage(argv[0]); exit(1); }
+				break;
+			case 'e':
+				if		( !strcmp(optarg,"pixels") )	scan_engine = SCAN_PIXELS;
+				else if	( !strcmp(optarg,"runs") )		scan_engine = SCAN_RUNS;
+				else { print_usage(argv[0]); exit(1); }
+				break;
+			default:	print_usage(argv[0]); exit(1);
+		}
+	}
+	// VERIFICATION against a flood fill, no input nor outputs
+	if( verify_rounds>0 ) return verify( verify_rounds ) ? 1 : 0;
+
+	if( trace_file!=NULL && bench_file==NULL && (trace_fid=fopen(trace_file,"w"))==NULL )
+	{ printf("Error opening file %s!\n",trace_file); exit(1); }
+	double t_start = wall_time(), t = t_start;	// stages traced by -J (see trace_stage)
+
+	// SHARDING: the merge needs the seam files only, the shards are checked below
+	if( (shard_dir!=NULL) != (shard_arg!=NULL) ) { print_usage(argv[0]); exit(1); }
+	if( shard_arg!=NULL )
+	{
+		if( !strncmp(shard_arg,"merge:",6) ) run_at = 6;
+		else if( sscanf(shard_arg,"%u:%u:%u:%n",&shard,&gx,&gy,&run_at)!=3 || gx==0 || gy==0 || shard>=gx*gy ) run_at = 0;
+		if( run_at==0 || shard_arg[run_at]==0 ) { print_usage(argv[0]); exit(1); }
+		run = run_hash( shard_arg+run_at );
+		if( mkdir(shard_dir,0777) && errno!=EEXIST )
+		{ printf("Error creating directory %s: %s\n",shard_dir,strerror(errno)); exit(1); }
+		snprintf( shard_abort_path, sizeof(shard_abort_path), "%s/run_%016llx.abort", shard_dir, (unsigned long long)run );
+		atexit( shard_abort );
+	}
+	if( shard_arg!=NULL && !strncmp(shard_arg,"merge:",6) )
+	{	// the labels are created -f bin, the format the shards write in place
+		shard_merge( shard_dir, out_file, run );
+		t = trace_stage( "merge", t );
+		if( trace_fid!=NULL ) fclose(trace_fid);
+		shard_abort_path[0] = 0;
+		return 0;
+	}
+
+	binary	= (bench_file!=NULL) ? 0 : map_mat(in_file, &map);
+	tiff	= (bench_file!=NULL || binary) ? 0 : map_tiff(in_file, &tif);
+	if( argc-optind<4 && !((binary || tiff || bench_file!=NULL) && argc-optind==2) ) { print_usage(argv[0]); exit(1); }
+	if( (window_file!=NULL) != (win_size!=0) ) { print_usage(argv[0]); exit(1); }
+	if( changes_file!=NULL && update_file==NULL ) { print_usage(argv[0]); exit(1); }
+	if( cache_dir!=NULL && mkdir(cache_dir,0777) && errno!=EEXIST )
+	{ printf("Error creating directory %s: %s\n",cache_dir,strerror(errno)); exit(1); }
+	if( spill_file!=NULL && (metrics_file!=NULL || window_file!=NULL) )
+	{ printf("Error: the landscape metrics need the labels in memory (no -S)!\n"); exit(1); }
+	if( spill_file!=NULL && update_file!=NULL )
+	{ printf("Error: the second epoch needs the labels of the first one in memory (no -S)!\n"); exit(1); }
+	if( binary && map.nbits==16 && !multi_class )
+	{ printf("Error in %s: 16 bits per pixel are classes (-M)!\n",in_file); exit(1); }
+	if( binary && map.nbits==1 && multi_class )
+	{ printf("Error in %s: classes need 8 or 16 bits per pixel!\n",in_file); exit(1); }
+	if( multi_class && (spill_file!=NULL || update_file!=NULL || cache_dir!=NULL || metrics_file!=NULL || window_file!=NULL || scan_engine==SCAN_RUNS) )
+	{ printf("Error: multi-class labeling (-M) works in memory, by pixels and without -u, -C, -m, -w!\n"); exit(1); }
+	if( multi_class && partition )
+	{ printf("Error: multi-class labeling (-M) needs the overlapping tiles, not -P!\n"); exit(1); }
+	if( (min_area>1 || largest>0 || hole_area>0) && (multi_class || spill_file!=NULL || update_file!=NULL) )
+	{ printf("Error: the filters (-a, -l, -F) work in memory, without -M, -u!\n"); exit(1); }
+	if( (dist_file!=NULL || near_file!=NULL) && spill_file!=NULL )
+	{ printf("Error: the distance transform (-d, -N) works in memory, not with -S!\n"); exit(1); }
+	if( shard_arg!=NULL && !(binary || tiff) )
+	{ printf("Error: sharded labeling needs a binary or TIFF mask!\n"); exit(1); }
+	if( shard_arg!=NULL && (spill_file!=NULL || stats_file!=NULL || metrics_file!=NULL || window_file!=NULL || update_file!=NULL || multi_class
+							|| min_area>1 || largest>0 || hole_area>0 || dist_file!=NULL || near_file!=NULL || bench_file!=NULL) )
+	{ printf("Error: sharded labeling (-Z) writes the labels only, without -S, -s, -m, -w, -u, -M, -a, -l, -F, -d, -N, -B!\n"); exit(1); }
+	if( bench_file!=NULL && (multi_class || spill_file!=NULL || update_file!=NULL || cache_dir!=NULL) )
+	{ printf("Error: the benchmark (-B) labels synthetic masks in memory, without -M, -S, -u, -C!\n"); exit(1); }
+	unsigned int tiledimX 	= atoi( argv[optind+0] );	// 0 (e.g. "auto"): see auto_tile_size
+	unsigned int tiledimY 	= atoi( argv[optind+1] );
+	unsigned int NC1 		= binary ? map.ncols : tiff ? tif.ncols : (argc-optind<4) ? BENCH_SIZE : atoi( argv[optind+2] );//98; // passed by JAI
+	unsigned int NR1 		= binary ? map.nrows : tiff ? tif.nrows : (argc-optind<4) ? BENCH_SIZE : atoi( argv[optind+3] );//98; // passed by JAI
+	if( (binary || tiff) && argc-optind>=4 && (atoi(argv[optind+2])!=NC1 || atoi(argv[optind+3])!=NR1) )
+	{ printf("Error: NC,NR differ from the size of %s [%d,%d]!\n",in_file,NC1,NR1); exit(1); }
+
+	// CONFIGURATION of the labeling, with the first scan kernel specialized for the connectivity
+	// and the pixels (see SCAN_KERNEL)
+	class_mat classes = { NULL, 0, binary ? map.nbits/8 : tiff ? 1 : 2 };	// text classes are uint16
+	label_config cfg = cli_config( classes.nbytes );
+
+	if( bench_file!=NULL )
+	{	// BENCHMARK: synthetic masks of NC x NR pixels at most, no input nor outputs
+		if( tiledimX==1 || tiledimY==1 || NC1==0 || NR1==0 ) { print_usage(argv[0]); exit(1); }
+		benchmark( bench_file, tiledimX, tiledimY, NR1, NC1 );
+		return 0;
+	}
+
+	// TILE SIZE: bytes of a tile per pixel are its label, its share of PARENT and of the statistics
+	// (one provisional label every 4/2/1 pixels, see nID) and its class
+	if( tiledimX==0 || tiledimY==0 )
+		auto_tile_size( NR1, NC1, 4 + multi_class*classes.nbytes
+						+ (4 + (stats_file ? sizeof(comp_stats) : 0)) / (multi_class ? 1 : (connectivity==8) ? 4 : 2),
+						cfg.threads, &tiledimX, &tiledimY );
+	if( tiledimX<2 || tiledimY<2 ) { print_usage(argv[0]); exit(1); }
+	if( tiff ) open_tiff_cache(&tif, tiledimY);
 
 	// DECLARATION:
-	unsigned int nID		= tiledimX*tiledimY/4 +1;
+	unsigned int nID		= tile_nID( tiledimX, tiledimY, &cfg );
 	unsigned int ntilesX,ntilesY,nTiles,iTile;
-	// X dir
-	ntilesX 				= ceil( (NC1+2-1) / (tiledimX-1)  );
-	unsigned int NC 		= ntilesX*(tiledimX-1) +1;
+	// X dir: every tile owns tiledimX-1 columns of the image (its first one is the last of the
+	// tile on its left), those of the last tile are what is left
+	ntilesX 				= (NC1 + tiledimX-2) / (tiledimX-1);
+	unsigned int NC 		= NC1+2;
 	// Y dir
-	ntilesY 				= ceil( (NR1+2-1) / (tiledimY-1)  );
-	unsigned int NR 		= ntilesY*(tiledimY-1) +1;
+	ntilesY 				= (NR1 + tiledimY-2) / (tiledimY-1);
+	unsigned int NR 		= NR1+2;
 	//
 	nTiles 					= ntilesX*ntilesY;
+	// the mask spans the whole tiles, its pixels beyond the (padded) image are background
+	unsigned int mask_rows	= _max( ntilesY*(tiledimY-1)+1, NR );
+	unsigned int mask_cols	= _max( ntilesX*(tiledimX-1)+1, NC );
 
 	unsigned int * (lab_mat[nTiles]);
-	unsigned int * (cont[nTiles]);
-	unsigned int i,j,k;
+	comp_stats * (tile_stats_[nTiles]);
+	comp_stats *obj_stats;
+	uint16_t *obj_classes;
+	tile_metrics * metrics = NULL;
 	unsigned int mc[nTiles];
-	unsigned int *(PARENT[nTiles]);
-	unsigned char *(urban[nTiles]);
-	unsigned int rr,cc,nn,ww;
-	unsigned int dim=0;
+	unsigned int nobjects;
 	unsigned int *dim_cum;
-	unsigned int *cross_parent;
+	label_writer writer;
 	unsigned int *final_parent;
-	unsigned int *first_pos_cp;
-	unsigned char *urban_gl;
+	unsigned int *labels;			// label raster: tile (ntY,ntX) at rows ntY*tiledimY, columns ntX*tiledimX
+	unsigned int *labels1 = NULL;	// label raster of the tiles changed in the second epoch
+	unsigned int stride = ntilesX*tiledimX;
+	packed_mat mask, mask1, image;
+
+	if( shard_arg!=NULL )
+	{	// SHARDING: the block of tiles of this process, merged with the others by -x merge
+		if( gx>ntilesX || gy>ntilesY ) { printf("Error: %u x %u shards of %u x %u tiles!\n",gx,gy,ntilesX,ntilesY); exit(1); }
+		shard_labeling( binary ? &map : NULL, tiff ? &tif : NULL, shard_dir, run, shard, gx, gy, tiledimX, tiledimY, NR, NC, ntilesX, ntilesY, nID, &cfg );
+		t = trace_stage( "shard", t );
+		if( binary ) unmap_mat(&map);
+		if( tiff ) unmap_tiff(&tif);
+		if( trace_fid!=NULL ) fclose(trace_fid);
+		shard_abort_path[0] = 0;
+		return 0;
+	}
+
+	if( spill_file!=NULL )
+	{	// STREAMING: the whole image is never resident
+		stream_labeling( in_file, binary ? &map : NULL, tiff ? &tif : NULL, out_file, spill_file, stats_file, tiledimX, tiledimY, NR, NC, ntilesX, ntilesY, nID, &cfg );
+		if( binary ) unmap_mat(&map);
+		if( tiff ) unmap_tiff(&tif);
+		if( trace_fid!=NULL ) fclose(trace_fid);
+		return 0;
+	}
 
 	dim_cum = (unsigned int*)malloc(nTiles*sizeof(int));
 
+	// one label raster for all tiles, every tile is labelled in place through its origin
+	labels = (unsigned int*)calloc((size_t)ntilesY*tiledimY*stride,sizeof(unsigned int));
+	if (labels == NULL) { printf("Error allocating the labels!\n"); exit(1); }
+	for(iTile = 0;iTile<nTiles;iTile++) lab_mat[iTile] = labels + (size_t)(iTile/ntilesX)*tiledimY*stride + (iTile%ntilesX)*tiledimX;
 
-	urban_gl	= (unsigned char*)calloc((NC)*(NR),sizeof(unsigned char));
-	sprintf(buffer,"/home/giuliano/git/soil-sealing/data/ALL.txt");
-	read_mat(urban_gl, NR, NC, buffer);
+	tiles_job job = { .mask = &mask, .map = binary ? &map : NULL, .tiff = tiff ? &tif : NULL, .NR = NR, .NC = NC, .tiledimX = tiledimX, .tiledimY = tiledimY,
+					  .ntilesX = ntilesX, .ntilesY = ntilesY, .nID = nID, .lab_mat = lab_mat, .stride = stride, .mc = mc, .dim_cum = dim_cum,
+					  .stats = (stats_file || min_area>1 || largest>0) ? tile_stats_ : NULL, .cfg = cfg };
+	if( trace_fid!=NULL )
+	{
+		job.trace = (tile_trace*)malloc(nTiles*sizeof(tile_trace));
+		if (job.trace == NULL) { printf("Error allocating the trace!\n"); exit(1); }
+	}
 
-	// 1st KERNEL INVOCATION: intra-tile labelingt-
-	for(iTile = 0;iTile<nTiles;iTile++)
-	{
-		// INITIALIZATION:
-		lab_mat[iTile]	= (unsigned int*)calloc((tiledimX)*(tiledimY),sizeof(unsigned int));
-		cont[iTile]		= (unsigned int*)malloc(nID*sizeof(unsigned int));
-		PARENT[iTile]	= (unsigned int*)calloc(nID*2,sizeof(unsigned int)); //critico! controllare quanto e' la dim max possibile!!
-		urban[iTile] 	= (unsigned char*)calloc((tiledimX)*(tiledimY),sizeof(unsigned char));
-
-		for(i=0;i<tiledimY;i++)
-			for(j=0;j<tiledimX;j++)
-				urban[iTile][j+tiledimX*i]=urban_gl[+ i*(NC)+j 						// dentro la 1° tile
-				                              + (tiledimX-1)*(iTile%ntilesX)		// itile in orizzontale
-				                              + (iTile/ntilesX)*(tiledimY-1)*NC];	// itile in verticale
-/*
-		sprintf(buffer,"iTile=%d",iTile);
-		print_mat(	urban[iTile],	tiledimY,		tiledimX, 	buffer	);
-*/
+	// the image is packed at 1 bit per pixel (rows of tiles in parallel for a binary/TIFF image),
+	// the classes of a multi-class image are kept aside and their objects are packed
+	init_packed(&mask, mask_rows, mask_cols);
+	image = packed_view(&mask, 0, 0, NR, NC);
+	if( multi_class )
+	{
+		init_classes(&classes, NR, NC, classes.nbytes);
+		job.classes = &classes;
+	}
+	if( binary || tiff ) run_tiles( job.cfg.threads, ntilesY, pack_tile_row, &job );
+	else if( multi_class ) read_classes(&image, &classes, in_file);
+	else read_mat(&image, in_file);
+	t = trace_stage( "read", t );
 
-		// KERNELs INVOCATION:
-		mc[iTile] = first_scan(urban[iTile],tiledimY,tiledimX,lab_mat[iTile],cont[iTile],nID,PARENT[iTile]);	//	(1) 1st SCAN
-		//sprintf(buffer,"iTile=%d -- 1scan",iTile);
-		//print_mat_int(	lab_mat[iTile],	tiledimY,		tiledimX, 	buffer	);
+	// HOLES smaller than hole_area are filled in the mask, before the objects are labelled
+	if( hole_area>0 )
+	{
+		fill_holes( &job, hole_area );
+		t = trace_stage( "holes", t );
+	}
 
-		union_equivalence(		nID, PARENT[iTile]);										//	(2) UNION
-		//sprintf(buffer,"ueq iTile=%d",iTile);
-		//print_mat_int(	lab_mat[iTile],	tiledimY,		tiledimX, 	buffer	);
+	// 1st KERNEL INVOCATION: intra-tile labelingt-
+	run_tiles( job.cfg.threads, nTiles, intra_tile_labeling, &job );
+	t = trace_stage( "intra_tile", t );
 
-		PARENT[iTile] = relabel_equivalence(	nID, mc[iTile], PARENT[iTile]);										//	(3) RELABEL
-		//sprintf(buffer,"PARENT[%d]",iTile);
-		//print_mat_int(	PARENT[iTile],	nID,		2, 	buffer	);
+	// 2nd KERNEL INVOCATION: inter-tile labeling, and RELABEL CROSS...
+	nobjects = cross_tile_equivalence( &job );
+	final_parent = job.final_parent;
+	trace_cross( &job, nobjects );
+	t = trace_stage( "cross_tile", t );
+	//print_vec( final_parent, dim, "final_parent -- after relabel_cross_equivalence" );
 
-		//																						//	(?)	COMPACT ==> no gaps in
-		second_scan(lab_mat[iTile],tiledimY,tiledimX, PARENT[iTile]);										//	(4) 2nd SCAN
-		//sprintf(buffer,"iTile=%d -- 2scan",iTile);
-		//print_mat_int(	lab_mat[iTile],	tiledimY,		tiledimX, 	buffer	);
+	// SECOND EPOCH: only the tiles whose pixels changed are labelled again
+	if( update_file!=NULL )
+	{
+		tiles_job job1	= job;
+		binary1	= map_mat(update_file, &map1);
+		tiff1	= binary1 ? 0 : map_tiff(update_file, &tif1);
+		if( (binary1 && (map1.ncols!=NC1 || map1.nrows!=NR1)) || (tiff1 && (tif1.ncols!=NC1 || tif1.nrows!=NR1)) )
+		{ printf("Error: %s differs in size from %s!\n",update_file,in_file); exit(1); }
+		if( binary1 && map1.nbits==16 ) { printf("Error in %s: 16 bits per pixel are classes (-M)!\n",update_file); exit(1); }
+		if( tiff1 ) open_tiff_cache(&tif1, tiledimY);
+		init_packed(&mask1, mask_rows, mask_cols);
+		image		= packed_view(&mask1, 0, 0, NR, NC);
+		job1.mask	= &mask1;
+		job1.map	= binary1 ? &map1 : NULL;
+		job1.tiff	= tiff1 ? &tif1 : NULL;
+		if( binary1 || tiff1 ) run_tiles( job1.cfg.threads, ntilesY, pack_tile_row, &job1 );
+		else read_mat(&image, update_file);
+		if( binary1 ) unmap_mat(&map1);
+		if( tiff1 ) unmap_tiff(&tif1);
+		nobjects = update_labeling( &job, &mask1, changes_file, &labels1 );
+		final_parent = job.final_parent;
+		t = trace_stage( "update", t );
 	}
 
-	dim_cum[0] = 0;
-	dim = mc[0];
-	for(iTile = 1;iTile<nTiles;iTile++)
+	// STATISTICS of the tile labels go to their objects (their areas to the filters too)
+	if( job.stats!=NULL )
 	{
-		dim += mc[iTile];
-		dim_cum[iTile] = dim_cum[iTile-1] + mc[iTile-1];
+		obj_stats = (comp_stats*)malloc((nobjects+1)*sizeof(comp_stats));
+		for(iTile=0;iTile<=nobjects;iTile++) init_stats(&obj_stats[iTile]);
+		for(iTile=0;iTile<nTiles;iTile++)
+		{
+			reduce_stats( obj_stats, tile_stats_[iTile], mc[iTile], final_parent+dim_cum[iTile] );
+			free(tile_stats_[iTile]);
+		}
+		// FILTERING: the objects dropped get ID 0 in final_parent and leave the mask
+		if( min_area>1 || largest>0 )
+		{
+			nobjects = filter_objects( obj_stats, nobjects, min_area, largest, final_parent, dim_cum[nTiles-1]+mc[nTiles-1] );
+			run_tiles( job.cfg.threads, ntilesY, filter_tile_row, &job );
+			t = trace_stage( "filter", t );
+		}
+		if( stats_file!=NULL )
+		{
+			obj_classes = multi_class ? object_classes( &job, nobjects ) : NULL;
+			write_stats( stats_file, obj_stats, nobjects, obj_classes );
+			free(obj_classes);
+			t = trace_stage( "stats", t );
+		}
+		free(obj_stats);
 	}
 
-	// 2nd KERNEL INVOCATION: inter-tile labeling
-	cross_parent = (unsigned int*)calloc(((tiledimY+tiledimX)*nTiles+dim)*cross_cols,sizeof(int));
-	final_parent = (unsigned int*)calloc(dim,sizeof(unsigned int));
-	first_pos_cp = cross_parent;
-	for(iTile = 0;iTile<nTiles;iTile++)
+	// FINAL SCAN (and partial landscape metrics of the tiles)
+	if( metrics_file!=NULL )
 	{
-		rr = iTile / ntilesX;					// CURRENT ROW (quoziente intero)
-		nn = iTile - ntilesX;					// tile index of nn
-		ww = ((rr*ntilesX)==iTile)?-1:iTile-1;	// tile index of ww
-		cross_parent = record_cross_equivalence(lab_mat,cross_parent,tiledimY,tiledimX,iTile, nn, ww, PARENT[iTile],mc[iTile]);
+		metrics = (tile_metrics*)malloc(nTiles*sizeof(tile_metrics));
+		job.metrics = metrics;
 	}
+	run_tiles( job.cfg.threads, nTiles, final_tile_labeling, &job );
+	if( metrics_file!=NULL )
+	{
+		write_metrics( metrics_file, metrics, nTiles, mc, dim_cum, final_parent, nobjects, (uint64_t)(NR-2)*(NC-2) );
+		free(metrics);
+	}
+	t = trace_stage( "final_scan", t );
 
-	unsigned int effective_nr;
-	effective_nr = (cross_parent - first_pos_cp)/cross_cols;
-	cross_parent = first_pos_cp;
-	//sprintf(buffer,"cross_parent -- after record_cross_equivalence");
-	//print_mat_int(	cross_parent,	effective_nr,		cross_cols, 	buffer	);
-
-	// UNION CROSS...
-	effective_nr = union_cross_equivalence( effective_nr, cross_parent);
-	//sprintf(buffer,"cross_parent -- after union_cross_equivalence");
-	//print_mat_int(	cross_parent,	effective_nr,		cross_cols, 	buffer	);
-
-	// RELABEL CROSS...
-	cross_parent = relabel_cross_equivalence(  final_parent,cross_parent,effective_nr,nTiles,mc);
-	//sprintf(buffer,"cross_parent -- after relabel_cross_equivalence");
-	//print_mat_int(	cross_parent,	effective_nr,		cross_cols, 	buffer	);
+	// MOVING WINDOWS over the final labels, one row of windows per task
+	if( window_file!=NULL )
+	{
+		job.nobjects	= nobjects;
+		job.win_size	= win_size;
+		job.win_step	= win_step;
+		job.win_rows	= (NR-2 + win_step-1)/win_step;
+		job.win_cols	= (NC-2 + win_step-1)/win_step;
+		job.windows		= (float*)malloc((size_t)job.win_rows*job.win_cols*WIN_METRICS*sizeof(float));
+		if (job.windows == NULL) { printf("Error allocating the windows!\n"); exit(1); }
+		run_tiles( job.cfg.threads, job.win_rows, window_row_metrics, &job );
+		write_windows( window_file, &job );
+		free(job.windows);
+		t = trace_stage( "windows", t );
+	}
 
-	// FINAL SCAN
-	for(iTile = 0;iTile<nTiles;iTile++)
+	// DISTANCE TRANSFORM to the objects, with the labels of the nearest ones
+	if( dist_file!=NULL || near_file!=NULL )
 	{
-		lab_mat[iTile] = third_scan(tiledimY, tiledimX, lab_mat[iTile], final_parent+dim_cum[iTile]);
-		//sprintf(buffer,"iTile[%4.0d ] -- 3scan",iTile);
-		//print_mat_int(	lab_mat[iTile],	tiledimY,		tiledimX, 	buffer	);
+		job.nobjects = nobjects;
+		distance_transform( &job, dist_file, near_file );
+		t = trace_stage( "distance", t );
 	}
 
 	// SAVE lab_mat to file and compare with MatLab
-	sprintf(buffer,"/home/giuliano/git/soil-sealing/data/Ccode.txt");
-	write_mat(lab_mat, tiledimX, tiledimY, ntilesX, ntilesY, buffer);
+	if( out_format==OUT_TEXT ) write_mat(lab_mat, tiledimY, tiledimX, stride, ntilesX, ntilesY, NR, NC, out_file);
+	else
+	{	// every row of tiles writes its own rows of labels
+		open_labels(&writer, out_file, NR-2, NC-2, nobjects, tiledimY-1, tiff ? &tif : NULL);
+		job.writer = &writer;
+		run_tiles( job.cfg.threads, ntilesY, write_tile_row, &job );
+		close_labels(&writer);
+	}
+	t = trace_stage( "write", t );
 
-	// FREE MEMORY:
-	for(iTile = 0;iTile<nTiles;iTile++)
+	// TRACE of the tiles (as last labelled) and of the run
+	if( trace_fid!=NULL )
 	{
-		free(cont[iTile]);
-		free(lab_mat[iTile]);
-		free(PARENT[iTile]);
-		free(urban[iTile]);
+		trace_tiles( &job, 0 );
+		trace_summary( &job, nobjects, t_start );
+		fclose(trace_fid);
+		free(job.trace);
 	}
+
+	// FREE MEMORY:
+	free(labels);
+	free(labels1);
+	if( update_file!=NULL ) free(mask1.words);
+	free(final_parent);
+	free(dim_cum);
+	free(mask.words);
+	free(classes.data);
+	if( binary ) unmap_mat(&map);
+	if( tiff ) unmap_tiff(&tif);
 	
 	// RETURN:
 	return 0;
 }
+#endif
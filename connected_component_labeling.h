@@ -0,0 +1,65 @@
+/*
+	Object:		Labeling library: the tiles, the first/second/third scan and the stitching of
+				connected_component_labeling.c, called in process on a mask in memory.
+	Authors:	Massimo Nicolazzo & Giuliano Langella
+	email:		gyuliano@libero.it
+
+	Build the library with -DCCL_LIBRARY (main is left out) and -pthread, e.g.
+		gcc -O2 -DCCL_LIBRARY -pthread -fPIC -shared connected_component_labeling.c -o libccl.so -lm
+
+	Usage:
+		ccl_context *ctx = ccl_create(NULL);		// default options
+		for every mask:
+			ccl_label(ctx, mask, rows, cols, rows_stride, labels, labels_stride, &nobjects);
+		ccl_destroy(ctx);
+
+	A context keeps the tiles of its last mask, the scratch of its threads and the forest of the
+	equivalences, so that masks of the same size (and no more objects) are labelled with no heap
+	allocations; the worker threads are started by every call. Different contexts label at the
+	same time from different threads (each with its own worker threads, see threads); one context
+	is used by one thread at a time.
+*/
+#ifndef CONNECTED_COMPONENT_LABELING_H
+#define CONNECTED_COMPONENT_LABELING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ENGINES of the first scan (see -e)
+#define CCL_PIXELS			0
+#define CCL_RUNS			1
+
+// OPTIONS of a context, the same of the command line
+typedef struct {
+	unsigned int	tiledimX, tiledimY;	// size of the tiles, 0 for auto (see auto_tile_size)
+	unsigned int	threads;			// workers labelling tiles concurrently (see -t)
+	unsigned int	connectivity;		// 8 or 4 (see -n)
+	unsigned int	engine;				// CCL_PIXELS or CCL_RUNS (see -e)
+	unsigned int	hierarchical;		// 1: merge the tile seams by blocks of tiles (see -H)
+	unsigned int	partition;			// 1: the tiles partition the mask, no overlap (see -P)
+} ccl_options;
+#define CCL_DEFAULT_OPTIONS	{ 0, 0, 1, 8, CCL_PIXELS, 0, 0 }
+
+typedef struct ccl_context ccl_context;
+
+// context with a copy of options (the defaults if NULL), NULL if they are not valid
+ccl_context *ccl_create( const ccl_options *options );
+
+// label the mask of rows x cols pixels, one byte each (1 object, any other value background),
+// row r starting at mask+r*stride: labels (1..nobjects, 0 background) go to row r of labels at
+// labels+r*labels_stride. It returns 0, or -1 if the arguments are not valid, memory is short
+// or a worker thread cannot start (ctx is then empty, and labels undefined)
+int ccl_label( ccl_context *ctx, const uint8_t *mask, unsigned int rows, unsigned int cols, size_t stride,
+			   uint32_t *labels, size_t labels_stride, unsigned int *nobjects );
+
+void ccl_destroy( ccl_context *ctx );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif